@@ -26,15 +26,19 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 
 #define PROG    "serialize"
 
 static void usage (int rc)
 {
-    puts ("Usage: " PROG " NAME INPUT\n");
+    puts ("Usage: " PROG " [-H] NAME INPUT\n");
     puts ("Will read INPUT and print on stdout a corresponding C file serialization\n"
-          "with symbol NAME as const char[] and NAME_size as size_t");
+          "with symbol NAME as const char[] and NAME_size as size_t\n\n"
+          "With -H, INPUT is kalu's HISTORY and what gets serialized is the markup\n"
+          "for the History window, as a NUL-terminated string (NUL not counted in\n"
+          "NAME_size)");
     _exit (rc);
 }
 
@@ -44,11 +48,88 @@ static void fatal (int rc, const char *msg)
     _exit (rc);
 }
 
+/* returns s with all occurrences of from replaced by to; s is free-d */
+static char *replace (char *s, const char *from, const char *to)
+{
+    size_t lf = strlen (from), lt = strlen (to), n = 0;
+    char *out, *o, *p, *m;
+
+    for (p = s; (p = strstr (p, from)); p += lf)
+        ++n;
+
+    out = malloc (strlen (s) - n * lf + n * lt + 1);
+    if (!out)
+        fatal (4, "failed to allocate memory");
+
+    for (o = out, p = s; (m = strstr (p, from)); p = m + lf)
+    {
+        memcpy (o, p, (size_t) (m - p));
+        o += m - p;
+        memcpy (o, to, lt);
+        o += lt;
+    }
+    strcpy (o, p);
+
+    free (s);
+    return out;
+}
+
+/* turns the HISTORY text (len bytes in buf) into markup for parse_to_buffer()
+ * in the History window */
+static char *history_markup (const char *buf, off_t len)
+{
+    char *s, *h;
+    off_t i;
+    size_t l = 0;
+
+    /* to preserve '<' & '>' */
+    s = malloc ((size_t) len * 5 + 1);
+    if (!s)
+        fatal (4, "failed to allocate memory");
+    for (i = 0; i < len; ++i)
+    {
+        if (buf[i] == '<' || buf[i] == '>')
+        {
+            memcpy (s + l, (buf[i] == '<') ? " <lt>" : " <gt>", 5);
+            l += 5;
+        }
+        else
+            s[l++] = buf[i];
+    }
+    s[l] = '\0';
+
+    /* to preserve LF-s */
+    s = replace (s, "\n\n", " <br>");
+    /* add empty line before each new line (change) */
+    s = replace (s, "<br>-", "<br><br>-");
+    /* to turn date/version number into titles (w/ some styling) */
+    s = replace (s, "\n# ", "<br><h2>");
+    for (h = s; (h = strstr (h, "<h2>")) && (h = strstr (h, " <br>")); )
+        memcpy (h, "</h2>", 5);
+
+    return s;
+}
+
+static void print_bytes (const char *b, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+        printf ("%s0x%.2hhx", (i == 0) ? "" : ", ", (unsigned int) b[i]);
+}
+
 int main (int argc, const char *argv[])
 {
     int fd;
     off_t len;
+    int is_history = 0;
 
+    if (argc == 4 && !strcmp (argv[1], "-H"))
+    {
+        is_history = 1;
+        ++argv;
+        --argc;
+    }
     if (argc != 3)
         usage (1);
 
@@ -64,6 +145,36 @@ int main (int argc, const char *argv[])
 
     printf ("#include <sys/types.h>\nconst char %s[] = { ", argv[1]);
 
+    if (is_history)
+    {
+        char buf[len], *s;
+        off_t l = 0;
+        ssize_t r;
+
+        while (l < len)
+        {
+            r = read (fd, buf + l, (size_t) (len - l));
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                fatal (3, "failed to read input");
+            }
+            if (r == 0)
+                break;
+            l += r;
+        }
+
+        s = history_markup (buf, l);
+        /* including the NUL */
+        print_bytes (s, strlen (s) + 1);
+        printf (" };\nsize_t %s_size = sizeof (%s) / sizeof (*%s) - 1;",
+                argv[1], argv[1], argv[1]);
+        free (s);
+        close (fd);
+        return 0;
+    }
+
     for (;;)
     {
         char buf[len], *b = buf;
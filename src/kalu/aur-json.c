@@ -0,0 +1,576 @@
+/**
+ * kalu - Copyright (C) 2012-2018 Olivier Brunel
+ *
+ * aur-json.c
+ * Copyright (C) 2012-2018 Olivier Brunel <jjk@jjacky.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+/* Streaming extractor for JSON from the AUR: data can be fed in chunks (e.g. as
+ * it is downloaded), and for every object found inside an array -- i.e. every
+ * package, be it in the "results" of an RPC response or the package metadata
+ * archive -- its Name, Version & Description are sent to a callback. Nothing
+ * else is kept, so no tree is ever built.
+ * Values are given as slices of the data fed whenever possible, i.e. unless
+ * they contain escaped characters or span over chunks, in which case they are
+ * copied into buffers re-used from one package to the next. */
+
+#include <config.h>
+
+/* C */
+#include <string.h>
+#include <ctype.h>  /* isalnum() */
+
+/* kalu */
+#include "kalu.h"
+#include "aur-json.h"
+
+/* max. nesting of arrays/objects */
+#define MAX_DEPTH   32
+/* max. length of a key we care about */
+#define MAX_KEY     16
+
+typedef enum {
+    FIELD_NAME = 0,
+    FIELD_VERSION,
+    FIELD_DESC,
+    NB_FIELDS,
+    FIELD_NONE = NB_FIELDS
+} field_t;
+
+static const char *field_keys[NB_FIELDS] = { "Name", "Version", "Description" };
+
+typedef enum {
+    ST_TOKEN = 0,   /* between tokens */
+    ST_STRING,
+    ST_ESCAPE,      /* after a backslash in a string */
+    ST_UNICODE,     /* in the hex digits of a \u escape */
+    ST_LITERAL      /* number, true, false or null */
+} state_t;
+
+typedef struct _value_t {
+    aur_json_str_t   s;
+    gboolean         is_slice;  /* s points into the chunk being parsed */
+    char            *buf;
+    size_t           alloc;
+} value_t;
+
+struct _aur_json_t {
+    aur_json_pkg_fn  fn;
+    gpointer         data;
+
+    state_t          state;
+    char             stack[MAX_DEPTH];  /* '{' or '[' */
+    int              depth;
+    int              pkg_depth;         /* of current package, 0 if none */
+    gboolean         has_root;
+    gboolean         expect_key;
+    gboolean         is_key;            /* current string is a key */
+    field_t          field;             /* where current string value goes */
+
+    char             key[MAX_KEY];
+    size_t           key_len;
+    value_t          values[NB_FIELDS];
+    gboolean         has[NB_FIELDS];
+
+    guint32          uc;
+    int              uc_digits;
+    guint32          surrogate;         /* pending high surrogate, or 0 */
+};
+
+static gboolean
+set_invalid (GError **error)
+{
+    debug ("invalid json");
+    g_set_error (error, KALU_ERROR, 8, _("Invalid JSON response from the AUR"));
+    return FALSE;
+}
+
+static void
+grow_value (value_t *value, size_t len)
+{
+    if (len >= value->alloc)
+    {
+        while (len >= value->alloc)
+        {
+            value->alloc = (value->alloc) ? value->alloc * 2 : 128;
+        }
+        value->buf = renew (char, value->alloc, value->buf);
+    }
+}
+
+/* copies the value into its buffer, so it doesn't point into the chunk */
+static void
+unslice_value (value_t *value)
+{
+    if (value->is_slice)
+    {
+        grow_value (value, value->s.len);
+        memcpy (value->buf, value->s.str, value->s.len);
+        value->s.str = value->buf;
+        value->is_slice = FALSE;
+    }
+}
+
+/* adds data from the chunk to the current string */
+static void
+add_bytes (aur_json_t *json, const char *s, size_t len)
+{
+    if (json->is_key)
+    {
+        if (json->key_len + len < MAX_KEY)
+        {
+            memcpy (json->key + json->key_len, s, len);
+        }
+        json->key_len += len;
+    }
+    else if (json->field != FIELD_NONE)
+    {
+        value_t *value = &json->values[json->field];
+
+        if (value->is_slice)
+        {
+            /* still contiguous in the chunk */
+            value->s.len += len;
+        }
+        else
+        {
+            grow_value (value, value->s.len + len);
+            memcpy (value->buf + value->s.len, s, len);
+            value->s.str = value->buf;
+            value->s.len += len;
+        }
+    }
+}
+
+/* adds decoded (i.e. not from the chunk) data to the current string */
+static void
+add_decoded (aur_json_t *json, const char *s, size_t len)
+{
+    if (!json->is_key && json->field != FIELD_NONE)
+    {
+        unslice_value (&json->values[json->field]);
+    }
+    add_bytes (json, s, len);
+}
+
+/* the chunk is going away, so values can't point into it anymore */
+static void
+pin_values (aur_json_t *json)
+{
+    field_t f;
+
+    for (f = 0; f < NB_FIELDS; ++f)
+    {
+        unslice_value (&json->values[f]);
+    }
+}
+
+static void
+add_codepoint (aur_json_t *json, guint32 cp)
+{
+    char s[4];
+
+    if (cp < 0x80)
+    {
+        s[0] = (char) cp;
+        add_decoded (json, s, 1);
+    }
+    else if (cp < 0x800)
+    {
+        s[0] = (char) (0xC0 | (cp >> 6));
+        s[1] = (char) (0x80 | (cp & 0x3F));
+        add_decoded (json, s, 2);
+    }
+    else if (cp < 0x10000)
+    {
+        s[0] = (char) (0xE0 | (cp >> 12));
+        s[1] = (char) (0x80 | ((cp >> 6) & 0x3F));
+        s[2] = (char) (0x80 | (cp & 0x3F));
+        add_decoded (json, s, 3);
+    }
+    else
+    {
+        s[0] = (char) (0xF0 | (cp >> 18));
+        s[1] = (char) (0x80 | ((cp >> 12) & 0x3F));
+        s[2] = (char) (0x80 | ((cp >> 6) & 0x3F));
+        s[3] = (char) (0x80 | (cp & 0x3F));
+        add_decoded (json, s, 4);
+    }
+}
+
+/* a high surrogate not followed by a low one is invalid */
+static inline void
+flush_surrogate (aur_json_t *json)
+{
+    if (json->surrogate)
+    {
+        add_codepoint (json, 0xFFFD);
+        json->surrogate = 0;
+    }
+}
+
+static void
+add_unicode (aur_json_t *json, guint32 cp)
+{
+    if (cp >= 0xD800 && cp <= 0xDBFF)
+    {
+        flush_surrogate (json);
+        json->surrogate = cp;
+        return;
+    }
+    else if (cp >= 0xDC00 && cp <= 0xDFFF)
+    {
+        if (!json->surrogate)
+        {
+            add_codepoint (json, 0xFFFD);
+            return;
+        }
+        cp = 0x10000 + ((json->surrogate - 0xD800) << 10) + (cp - 0xDC00);
+        json->surrogate = 0;
+    }
+    else
+    {
+        flush_surrogate (json);
+    }
+    add_codepoint (json, cp);
+}
+
+static void
+end_string (aur_json_t *json)
+{
+    flush_surrogate (json);
+
+    if (json->is_key)
+    {
+        json->field = FIELD_NONE;
+        /* only interested in (some) keys of the package itself */
+        if (json->depth == json->pkg_depth && json->key_len < MAX_KEY)
+        {
+            field_t f;
+
+            for (f = 0; f < NB_FIELDS; ++f)
+            {
+                if (strlen (field_keys[f]) == json->key_len
+                        && memcmp (field_keys[f], json->key, json->key_len) == 0)
+                {
+                    json->field = f;
+                    break;
+                }
+            }
+        }
+        json->expect_key = FALSE;
+        json->is_key = FALSE;
+    }
+    else if (json->field != FIELD_NONE)
+    {
+        json->has[json->field] = TRUE;
+        json->field = FIELD_NONE;
+    }
+}
+
+/* p is the current position in the chunk */
+static gboolean
+process_token (aur_json_t *json, const char *p, GError **error)
+{
+    char open;
+
+    switch (*p)
+    {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+            return TRUE;
+
+        case '{':
+        case '[':
+            if (json->expect_key || json->depth == MAX_DEPTH)
+            {
+                return set_invalid (error);
+            }
+            /* an object inside an array is a package */
+            if (*p == '{' && json->pkg_depth == 0 && json->depth > 0
+                    && json->stack[json->depth - 1] == '[')
+            {
+                field_t f;
+
+                json->pkg_depth = json->depth + 1;
+                for (f = 0; f < NB_FIELDS; ++f)
+                {
+                    json->has[f] = FALSE;
+                }
+            }
+            json->stack[json->depth++] = *p;
+            json->has_root = TRUE;
+            json->expect_key = (*p == '{');
+            json->field = FIELD_NONE;
+            return TRUE;
+
+        case '}':
+        case ']':
+            open = (*p == '}') ? '{' : '[';
+            if (json->depth == 0 || json->stack[json->depth - 1] != open)
+            {
+                return set_invalid (error);
+            }
+            if (json->depth == json->pkg_depth)
+            {
+                field_t f;
+
+                json->pkg_depth = 0;
+                if (json->has[FIELD_NAME] && json->has[FIELD_VERSION]
+                        && !json->fn (&json->values[FIELD_NAME].s,
+                            &json->values[FIELD_VERSION].s,
+                            (json->has[FIELD_DESC])
+                            ? &json->values[FIELD_DESC].s : NULL,
+                            json->data, error))
+                {
+                    return FALSE;
+                }
+                /* done with those, no need to ever copy them */
+                for (f = 0; f < NB_FIELDS; ++f)
+                {
+                    json->values[f].is_slice = FALSE;
+                }
+            }
+            --json->depth;
+            json->expect_key = FALSE;
+            json->field = FIELD_NONE;
+            return TRUE;
+
+        case ',':
+            if (json->depth == 0)
+            {
+                return set_invalid (error);
+            }
+            json->expect_key = (json->stack[json->depth - 1] == '{');
+            return TRUE;
+
+        case ':':
+            if (json->depth == 0 || json->stack[json->depth - 1] != '{')
+            {
+                return set_invalid (error);
+            }
+            json->expect_key = FALSE;
+            return TRUE;
+
+        case '"':
+            json->state = ST_STRING;
+            json->has_root = TRUE;
+            json->is_key = json->expect_key;
+            json->surrogate = 0;
+            if (json->is_key)
+            {
+                json->key_len = 0;
+            }
+            else if (json->field != FIELD_NONE)
+            {
+                value_t *value = &json->values[json->field];
+
+                value->s.str = p + 1;
+                value->s.len = 0;
+                value->is_slice = TRUE;
+            }
+            return TRUE;
+
+        default:
+            if (json->expect_key || !(isalnum ((unsigned char) *p) || *p == '-'))
+            {
+                return set_invalid (error);
+            }
+            /* not a string, e.g. a null Description */
+            if (json->field != FIELD_NONE)
+            {
+                json->has[json->field] = FALSE;
+                json->field = FIELD_NONE;
+            }
+            json->state = ST_LITERAL;
+            json->has_root = TRUE;
+            return TRUE;
+    }
+}
+
+static int
+hex_value (char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    else if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    else if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+aur_json_t *
+aur_json_new (aur_json_pkg_fn fn, gpointer data)
+{
+    aur_json_t *json;
+
+    json = new0 (aur_json_t, 1);
+    json->fn = fn;
+    json->data = data;
+    json->field = FIELD_NONE;
+    return json;
+}
+
+gboolean
+aur_json_feed (aur_json_t *json, const char *chunk, size_t len, GError **error)
+{
+    const char *p, *e = chunk + len;
+
+    for (p = chunk; p < e; ++p)
+    {
+        const char *s;
+        char c;
+        int v;
+
+        switch (json->state)
+        {
+            case ST_STRING:
+                /* take everything up to the next special character at once */
+                for (s = p; p < e && *p != '"' && *p != '\\'
+                        && (unsigned char) *p >= 0x20; ++p)
+                    ;
+                if (p > s)
+                {
+                    flush_surrogate (json);
+                    add_bytes (json, s, (size_t) (p - s));
+                }
+                if (p == e)
+                {
+                    pin_values (json);
+                    return TRUE;
+                }
+                if (*p == '"')
+                {
+                    end_string (json);
+                    json->state = ST_TOKEN;
+                }
+                else if (*p == '\\')
+                {
+                    json->state = ST_ESCAPE;
+                }
+                else
+                {
+                    return set_invalid (error);
+                }
+                break;
+
+            case ST_ESCAPE:
+                json->state = ST_STRING;
+                switch (*p)
+                {
+                    case '"':
+                    case '\\':
+                    case '/':
+                        c = *p;
+                        break;
+                    case 'b':
+                        c = '\b';
+                        break;
+                    case 'f':
+                        c = '\f';
+                        break;
+                    case 'n':
+                        c = '\n';
+                        break;
+                    case 'r':
+                        c = '\r';
+                        break;
+                    case 't':
+                        c = '\t';
+                        break;
+                    case 'u':
+                        json->uc = 0;
+                        json->uc_digits = 0;
+                        json->state = ST_UNICODE;
+                        continue;
+                    default:
+                        return set_invalid (error);
+                }
+                flush_surrogate (json);
+                add_decoded (json, &c, 1);
+                break;
+
+            case ST_UNICODE:
+                v = hex_value (*p);
+                if (v < 0)
+                {
+                    return set_invalid (error);
+                }
+                json->uc = (json->uc << 4) | (guint32) v;
+                if (++json->uc_digits == 4)
+                {
+                    add_unicode (json, json->uc);
+                    json->state = ST_STRING;
+                }
+                break;
+
+            case ST_LITERAL:
+                if (isalnum ((unsigned char) *p) || *p == '.' || *p == '-'
+                        || *p == '+')
+                {
+                    break;
+                }
+                json->state = ST_TOKEN;
+                /* the delimiter is then processed as a token */
+                /* fall through */
+
+            case ST_TOKEN:
+                if (!process_token (json, p, error))
+                {
+                    return FALSE;
+                }
+                break;
+        }
+    }
+
+    pin_values (json);
+    return TRUE;
+}
+
+/* to be called once all data was fed, to make sure it was complete */
+gboolean
+aur_json_end (aur_json_t *json, GError **error)
+{
+    if (!json->has_root || json->depth > 0
+            || (json->state != ST_TOKEN && json->state != ST_LITERAL))
+    {
+        return set_invalid (error);
+    }
+    return TRUE;
+}
+
+void
+aur_json_free (aur_json_t *json)
+{
+    field_t f;
+
+    for (f = 0; f < NB_FIELDS; ++f)
+    {
+        free (json->values[f].buf);
+    }
+    free (json);
+}
@@ -0,0 +1,58 @@
+/**
+ * kalu - Copyright (C) 2012-2018 Olivier Brunel
+ *
+ * aur-json.h
+ * Copyright (C) 2012-2018 Olivier Brunel <jjk@jjacky.com>
+ *
+ * This file is part of kalu.
+ *
+ * kalu is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * kalu is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * kalu. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef _KALU_AUR_JSON_H
+#define _KALU_AUR_JSON_H
+
+/* glib */
+#include <glib-2.0/glib.h>
+
+typedef struct _aur_json_t aur_json_t;
+
+/* a string value; Not NULL-terminated, usually pointing into the data fed */
+typedef struct _aur_json_str_t {
+    const char  *str;
+    size_t       len;
+} aur_json_str_t;
+
+/* called for each package (i.e. object inside an array) found. Strings are
+ * only valid during the call; desc is NULL if missing/null. Returning FALSE
+ * aborts parsing */
+typedef gboolean (*aur_json_pkg_fn) (const aur_json_str_t  *name,
+                                     const aur_json_str_t  *version,
+                                     const aur_json_str_t  *desc,
+                                     gpointer               data,
+                                     GError               **error);
+
+aur_json_t *
+aur_json_new (aur_json_pkg_fn fn, gpointer data);
+
+gboolean
+aur_json_feed (aur_json_t *json, const char *chunk, size_t len, GError **error);
+
+gboolean
+aur_json_end (aur_json_t *json, GError **error);
+
+void
+aur_json_free (aur_json_t *json);
+
+#endif /* _KALU_AUR_JSON_H */
@@ -23,8 +23,15 @@
 #include <config.h>
 
 /* C */
+#include <stdio.h>
 #include <string.h>
 #include <ctype.h>  /* isalnum() */
+#include <unistd.h> /* unlink() */
+#include <utime.h>
+#include <sys/stat.h>
+
+/* zlib */
+#include <zlib.h>
 
 /* glib */
 #include <glib-2.0/glib.h>
@@ -39,307 +46,918 @@
 /* kalu */
 #include "kalu.h"
 #include "aur.h"
+#include "aur-json.h"
 #include "curl.h"
+#include "util.h"
+
+/* max. number of packages queried in a single request */
+#define AUR_MAX_PKGS_PER_REQUEST    500
+
+/* names up to that long are handled without allocation */
+#define NAME_BUF_SIZE               256
+
+/* name of the cache of AUR results (in our cache folder) */
+#define AUR_CACHE                   "aur.json"
+
+/* name of the index made from the AUR metadata archive (in our cache folder) */
+#define AUR_ARCHIVE_INDEX           "aur-meta.idx"
+/* first line of the index, then it's name, version & description of each
+ * package, as NULL-terminated strings */
+#define AUR_ARCHIVE_INDEX_MAGIC     "kalu-aur-index 1\n"
 
-#define MAX_URL_LENGTH          1024
+/* AUR info about a package, as queried or loaded from cache */
+typedef struct _aur_info_t {
+    char    *name;
+    char    *version;   /* NULL if the package wasn't found */
+    char    *desc;
+    char    *installed; /* local version when fetched */
+    gint64   fetched;
+    gint64   expires;
+} aur_info_t;
 
-static void *
-get_pkg_from_list (const char *pkgname, alpm_list_t *pkgs, gboolean is_watched)
+struct _aur_results_t {
+    GHashTable *infos;  /* name -> aur_info_t */
+};
+
+/* data shared with add_result() while downloading */
+typedef struct _aur_query_t {
+    GHashTable *wanted;     /* name -> installed version */
+    GHashTable *queried;    /* names queried but not (yet) found */
+    GHashTable *infos;      /* name -> aur_info_t */
+    gint64      now;
+} aur_query_t;
+
+/* data shared with parse_archive() while downloading */
+typedef struct _archive_t {
+    aur_query_t *query;
+    aur_json_t  *json;
+    z_stream     zs;
+    gboolean     is_detected;   /* whether we know if it's gzipped */
+    gboolean     is_gzip;
+    gboolean     is_end;        /* end of gzip stream reached */
+    FILE        *fp;            /* index being written */
+    guint        nb_pkgs;
+    char         out[64 * 1024];
+} archive_t;
+
+static void
+free_info (aur_info_t *info)
 {
-    alpm_list_t *i;
-    const char *name;
-    FOR_LIST (i, pkgs)
+    free (info->name);
+    free (info->version);
+    free (info->desc);
+    free (info->installed);
+    free (info);
+}
+
+static GHashTable *
+new_infos (void)
+{
+    return g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+            (GDestroyNotify) free_info);
+}
+
+static void
+get_cache_file (char *file)
+{
+    snprintf (file, PATH_MAX, "%s/kalu/" AUR_CACHE, g_get_user_cache_dir ());
+}
+
+static const char *
+get_json_string (cJSON *item, const char *name)
+{
+    cJSON *json = cJSON_GetObjectItem (item, name);
+
+    return (json && json->type == cJSON_String) ? json->valuestring : NULL;
+}
+
+static gint64
+get_json_time (cJSON *item, const char *name)
+{
+    cJSON *json = cJSON_GetObjectItem (item, name);
+
+    return (json && json->type == cJSON_Number) ? (gint64) json->valuedouble : 0;
+}
+
+static GHashTable *
+load_cache (void)
+{
+    GHashTable *cache;
+    char file[PATH_MAX];
+    gchar *data;
+    cJSON *json, *item;
+
+    cache = new_infos ();
+
+    get_cache_file (file);
+    if (!g_file_get_contents (file, &data, NULL, NULL))
     {
-        if (is_watched)
+        return cache;
+    }
+    /* strings of the tree point into data, so it must be kept around */
+    json = cJSON_ParseArena (data);
+    if (!json)
+    {
+        debug ("invalid AUR cache, ignoring");
+        g_free (data);
+        return cache;
+    }
+
+    cJSON_ArrayForEach (item, json)
+    {
+        aur_info_t *info;
+        const char *name, *installed, *version, *desc;
+
+        name = get_json_string (item, "Name");
+        installed = get_json_string (item, "Installed");
+        if (!name || !installed)
         {
-            name = ((watched_package_t *) i->data)->name;
+            continue;
         }
-        else
+        version = get_json_string (item, "Version");
+        desc = get_json_string (item, "Description");
+
+        info = new0 (aur_info_t, 1);
+        info->name = strdup (name);
+        info->installed = strdup (installed);
+        info->version = (version) ? strdup (version) : NULL;
+        info->desc = strdup ((desc) ? desc : "");
+        info->fetched = get_json_time (item, "Fetched");
+        info->expires = get_json_time (item, "Expires");
+        g_hash_table_replace (cache, info->name, info);
+    }
+    cJSON_Delete (json);
+    g_free (data);
+
+    debug ("loaded %d entries from AUR cache", g_hash_table_size (cache));
+    return cache;
+}
+
+static void
+save_cache (GHashTable *cache, gint64 now)
+{
+    GHashTableIter iter;
+    aur_info_t *info;
+    char file[PATH_MAX];
+    char *data;
+    cJSON *json;
+    cJSON *last = NULL;
+
+    json = cJSON_CreateArray ();
+    g_hash_table_iter_init (&iter, cache);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer) &info))
+    {
+        cJSON *item;
+
+        /* forget about entries that haven't been refreshed in a while, i.e. of
+         * packages not installed/watched anymore */
+        if (now > info->expires + (gint64) config->aur_cache_ttl)
         {
-            name = alpm_pkg_get_name ((alpm_pkg_t *) i->data);
+            continue;
         }
-        if (streq (pkgname, name))
+
+        item = cJSON_CreateObject ();
+        cJSON_AddStringToObject (item, "Name", info->name);
+        if (info->version)
         {
-            return i->data;
+            cJSON_AddStringToObject (item, "Version", info->version);
         }
+        else
+        {
+            cJSON_AddNullToObject (item, "Version");
+        }
+        cJSON_AddStringToObject (item, "Description", info->desc);
+        cJSON_AddStringToObject (item, "Installed", info->installed);
+        cJSON_AddNumberToObject (item, "Fetched", (double) info->fetched);
+        cJSON_AddNumberToObject (item, "Expires", (double) info->expires);
+        cJSON_AddItemToArrayAfter (json, last, item);
+        last = item;
     }
-    return NULL;
+    data = cJSON_PrintUnformatted (json);
+    cJSON_Delete (json);
+
+    get_cache_file (file);
+    if (!data || !ensure_path (file)
+            || !g_file_set_contents (file, data, -1, NULL))
+    {
+        debug ("unable to save AUR cache %s", file);
+    }
+    free (data);
+}
+
+/* pkgver is NULL if the package wasn't found */
+static void
+set_info (aur_query_t          *query,
+          const char           *pkgname,
+          const aur_json_str_t *pkgver,
+          const aur_json_str_t *pkgdesc)
+{
+    aur_info_t *info;
+    gint64 ttl = (gint64) config->aur_cache_ttl;
+
+    info = new0 (aur_info_t, 1);
+    info->name = strdup (pkgname);
+    info->version = (pkgver) ? strndup (pkgver->str, pkgver->len) : NULL;
+    info->desc = (pkgdesc) ? strndup (pkgdesc->str, pkgdesc->len) : strdup ("");
+    info->installed = strdup (g_hash_table_lookup (query->wanted, pkgname));
+    info->fetched = query->now;
+    /* spread expiration +/- 25% around the TTL, so all packages don't expire
+     * (and get queried) at the same time */
+    info->expires = query->now + ttl * 3 / 4
+        + (gint64) g_random_double_range (0, (gdouble) ttl / 2);
+    g_hash_table_replace (query->infos, info->name, info);
 }
 
-static gint
-find_nf (gpointer data, gpointer _find_data)
+/* returns name as a NULL-terminated string, in buf when it fits */
+static char *
+get_name (const aur_json_str_t *name, char *buf)
 {
-    struct {
-        gboolean is_watched;
-        const gchar *pkgname;
-    } *find_data = _find_data;
+    char *s;
 
-    if (find_data->is_watched)
+    s = (name->len < NAME_BUF_SIZE) ? buf : new (char, name->len + 1);
+    memcpy (s, name->str, name->len);
+    s[name->len] = '\0';
+    return s;
+}
+
+static void
+free_name (char *name, char *buf)
+{
+    if (name != buf)
     {
-        return strcmp (((watched_package_t *) data)->name, find_data->pkgname);
+        free (name);
     }
-    else
+}
+
+/* called for each package in a response from the RPC */
+static gboolean
+add_result (const aur_json_str_t   *name,
+            const aur_json_str_t   *version,
+            const aur_json_str_t   *desc,
+            aur_query_t            *query,
+            GError                **error)
+{
+    char buf[NAME_BUF_SIZE];
+    char *pkgname;
+
+    pkgname = get_name (name, buf);
+    /* ALPM/watched */
+    if (!g_hash_table_lookup (query->wanted, pkgname))
     {
-        return strcmp (alpm_pkg_get_name ((alpm_pkg_t *) data), find_data->pkgname);
+        debug ("package %s not found in aur_pkgs", pkgname);
+        g_set_error (error, KALU_ERROR, 8,
+                _("Unexpected results from the AUR [%s]"),
+                pkgname);
+        free_name (pkgname, buf);
+        return FALSE;
     }
+    set_info (query, pkgname, version, desc);
+    g_hash_table_remove (query->queried, pkgname);
+    free_name (pkgname, buf);
+    return TRUE;
 }
 
-#define add(str)    do {                            \
-    len = snprintf (s, (size_t) max, "%s", str);    \
-    max -= len;                                     \
-    s += len;                                       \
-} while (0)
-gboolean
-aur_has_updates (alpm_list_t **packages,
-                 alpm_list_t **not_found,
-                 alpm_list_t *aur_pkgs,
-                 gboolean is_watched,
-                 GError **error)
+static gboolean
+parse_chunk (const char *chunk, size_t len, aur_json_t *json, GError **error)
 {
-    alpm_list_t *urls = NULL, *i;
-    alpm_list_t *list_nf = NULL;
-    char buf[MAX_URL_LENGTH + 1], *s;
-    int max, len;
-    int len_prefix = (int) strlen (AUR_URL_PREFIX_PKG);
-    GError *local_err = NULL;
-    char *data;
-    const char *pkgname, *pkgdesc, *pkgver, *oldver;
-    cJSON *json, *results, *package;
-    int c, j;
-    void *pkg;
-    kalu_package_t *kpkg;
+    return aur_json_feed (json, chunk, len, error);
+}
 
-    debug ((is_watched)
-            ? "looking for Watched AUR updates"
-            : "looking for AUR updates");
+/* called once a response was downloaded, and therefore parsed */
+static gboolean
+parse_results (curl_request_t  *request,
+               char            *content _UNUSED_,
+               aur_query_t     *query _UNUSED_,
+               GError         **error)
+{
+    return aur_json_end (request->sink_data, error);
+}
 
-    /* print start of url */
-    max = MAX_URL_LENGTH;
-    s = buf;
-    add (AUR_URL_PREFIX);
+static curl_request_t *
+new_request (const char *url, GString *post, aur_query_t *query)
+{
+    curl_request_t *request;
 
-    FOR_LIST (i, aur_pkgs)
-    {
-        char *end;
-        const char *p;
+    request = new0 (curl_request_t, 1);
+    request->url = url;
+    request->post = g_string_free (post, FALSE);
+    /* results are parsed as they're downloaded */
+    request->sink_fn = (curl_sink_fn) parse_chunk;
+    request->sink_data = aur_json_new ((aur_json_pkg_fn) add_result, query);
+    return request;
+}
 
-        if (is_watched)
+static void
+free_request (curl_request_t *request)
+{
+    aur_json_free (request->sink_data);
+    free (request->post);
+    free (request);
+}
+
+/* adds pkgname to the POST data, urlencoding it */
+static void
+add_pkgname (GString *post, const char *pkgname)
+{
+    const char hex[] = "0123456789ABCDEF";
+    const unsigned char *p;
+
+    /* arguments are appended to the query from AUR_URL_PREFIX, if any */
+    g_string_append (post, AUR_URL_PREFIX_PKG
+            + ((post->len == 0 && *AUR_URL_PREFIX_PKG == '&') ? 1 : 0));
+    for (p = (const unsigned char *) pkgname; *p; ++p)
+    {
+        /* unreserved characters */
+        if (isalnum (*p) || *p == '-' || *p == '_' || *p == '.' || *p == '~')
         {
-            pkgname = ((watched_package_t *) i->data)->name;
+            g_string_append_c (post, (gchar) *p);
         }
         else
         {
-            pkgname = alpm_pkg_get_name ((alpm_pkg_t *) i->data);
+            /* Credit to Fred Bullback for the following */
+            g_string_append_c (post, '%');
+            g_string_append_c (post, hex[*p >> 4]);
+            g_string_append_c (post, hex[*p & 15]);
         }
+    }
+}
 
-        /* fill list of not found packages */
-        if (not_found || is_watched)
-        {
-            list_nf = alpm_list_add (list_nf, i->data);
-        }
+/* queries the AUR's RPC for all packages not in (valid) cache */
+static gboolean
+query_rpc (aur_query_t *query, gboolean use_cache, GError **error)
+{
+    alpm_list_t *requests = NULL;
+    GString *post = NULL;
+    GHashTableIter iter;
+    char *url, *query_str;
+    const char *pkgname, *installed;
+    int nb = 0;
+    guint nb_cached = 0;
+    gboolean has_cache = (config->aur_cache_ttl > 0);
+    GError *local_err = NULL;
+
+    query->infos = (has_cache) ? load_cache () : new_infos ();
 
-        /* make sure we can at least add the prefix */
-        if (len_prefix > max)
+    /* we send everything via POST: the query part of the URL goes in the data
+     * as well, followed by all package names */
+    url = strdup (AUR_URL_PREFIX);
+    query_str = strchr (url, '?');
+    if (query_str)
+    {
+        *query_str++ = '\0';
+    }
+
+    g_hash_table_iter_init (&iter, query->wanted);
+    while (g_hash_table_iter_next (&iter, (gpointer) &pkgname,
+                (gpointer) &installed))
+    {
+        /* can we use the cached result? Only if it hasn't expired, and the
+         * local version hasn't changed since */
+        if (use_cache && has_cache)
         {
-            /* nope. so we store this url and start a new one */
-            urls = alpm_list_add (urls, strdup (buf));
-            max = MAX_URL_LENGTH;
-            s = buf;
-            add (AUR_URL_PREFIX);
+            aur_info_t *info;
+
+            info = g_hash_table_lookup (query->infos, pkgname);
+            if (info && query->now < info->expires
+                    && streq (info->installed, installed))
+            {
+                ++nb_cached;
+                continue;
+            }
         }
+        g_hash_table_add (query->queried, (gpointer) pkgname);
 
-        /* this is where we'll end the URL, should there not be enough space */
-        end = s;
-        /* add prefix */
-        add (AUR_URL_PREFIX_PKG);
-        /* now we add the pkgname; one char at a time, urlencoding if needed */
-        for (p = pkgname; *p; ++p)
+        if (!post)
         {
-            /* unreserved characters */
-            if (isalnum (*p) || *p == '-' || *p == '_' || *p == '.' || *p == '~')
+            post = g_string_sized_new (4096);
+            if (query_str)
             {
-                if (max < 1)
-                {
-                    /* add url until this pkg and start a new one */
-                    *end = '\0';
-                    urls = alpm_list_add (urls, strdup (buf));
-                    max = MAX_URL_LENGTH;
-                    s = buf;
-                    add (AUR_URL_PREFIX);
-                    /* reset to start this pkgname over */
-                    end = s;
-                    add (AUR_URL_PREFIX_PKG);
-                    p = pkgname - 1;
-                    continue;
-                }
-                *s++ = *p;
-                --max;
+                g_string_append (post, query_str);
             }
-            else
+        }
+        add_pkgname (post, pkgname);
+
+        /* only so many packages per request */
+        if (++nb == AUR_MAX_PKGS_PER_REQUEST)
+        {
+            requests = alpm_list_add (requests, new_request (url, post, query));
+            post = NULL;
+            nb = 0;
+        }
+    }
+    if (post)
+    {
+        requests = alpm_list_add (requests, new_request (url, post, query));
+    }
+
+    if (has_cache)
+    {
+        debug ("%u packages from AUR cache, %u to query",
+                nb_cached, g_hash_table_size (query->queried));
+    }
+
+    /* download (in parallel) & parse results as they come */
+    if (requests && !curl_download_multi (requests, (guint) config->aur_parallel,
+                (curl_multi_cb) parse_results, query, &local_err))
+    {
+        g_propagate_error (error, local_err);
+    }
+    alpm_list_free_inner (requests, (alpm_list_fn_free) free_request);
+    alpm_list_free (requests);
+    free (url);
+
+    return (local_err == NULL);
+}
+
+static void
+get_index_file (char *file)
+{
+    snprintf (file, PATH_MAX, "%s/kalu/" AUR_ARCHIVE_INDEX,
+            g_get_user_cache_dir ());
+}
+
+/* reads info about packages still to be found from the index (made from the
+ * metadata archive) */
+static gboolean
+load_index (aur_query_t *query, const char *file)
+{
+    GMappedFile *mapped;
+    const char *s, *e, *name, *version, *desc;
+    size_t magic_len = strlen (AUR_ARCHIVE_INDEX_MAGIC);
+    size_t nb = 0;
+
+    mapped = g_mapped_file_new (file, FALSE, NULL);
+    if (!mapped)
+    {
+        return FALSE;
+    }
+    s = g_mapped_file_get_contents (mapped);
+    e = s + g_mapped_file_get_length (mapped);
+
+    /* records are NULL-terminated strings, so the last byte must be one */
+    if ((size_t) (e - s) < magic_len || !streqn (s, AUR_ARCHIVE_INDEX_MAGIC, magic_len)
+            || ((size_t) (e - s) > magic_len && e[-1] != '\0'))
+    {
+        g_mapped_file_unref (mapped);
+        debug ("invalid AUR index %s", file);
+        return FALSE;
+    }
+    s += magic_len;
+
+    /* the whole index is validated first, i.e. made only of (name, version,
+     * desc) triplets, since once info is set there's no going back (to the
+     * archive) */
+    for (name = s; name < e; ++nb)
+    {
+        name = (const char *) memchr (name, '\0', (size_t) (e - name)) + 1;
+    }
+    if (nb % 3 != 0)
+    {
+        g_mapped_file_unref (mapped);
+        debug ("invalid AUR index %s", file);
+        return FALSE;
+    }
+
+    while (s < e)
+    {
+        name = s;
+        s += strlen (s) + 1;
+        version = s;
+        s += strlen (s) + 1;
+        desc = s;
+        s += strlen (s) + 1;
+
+        if (g_hash_table_remove (query->queried, name))
+        {
+            aur_json_str_t pkgver = { version, strlen (version) };
+            aur_json_str_t pkgdesc = { desc, strlen (desc) };
+
+            set_info (query, name, &pkgver, &pkgdesc);
+        }
+    }
+    g_mapped_file_unref (mapped);
+
+    return TRUE;
+}
+
+static gboolean
+add_archive_pkg (const aur_json_str_t  *name,
+                 const aur_json_str_t  *version,
+                 const aur_json_str_t  *desc,
+                 archive_t             *archive,
+                 GError               **error _UNUSED_)
+{
+    aur_json_str_t empty = { "", 0 };
+    char buf[NAME_BUF_SIZE];
+    char *pkgname;
+
+    if (!desc)
+    {
+        desc = &empty;
+    }
+
+    ++archive->nb_pkgs;
+    if (archive->fp)
+    {
+        fwrite (name->str, 1, name->len, archive->fp);
+        fputc ('\0', archive->fp);
+        fwrite (version->str, 1, version->len, archive->fp);
+        fputc ('\0', archive->fp);
+        fwrite (desc->str, 1, desc->len, archive->fp);
+        fputc ('\0', archive->fp);
+    }
+
+    pkgname = get_name (name, buf);
+    if (g_hash_table_remove (archive->query->queried, pkgname))
+    {
+        set_info (archive->query, pkgname, version, desc);
+    }
+    free_name (pkgname, buf);
+    return TRUE;
+}
+
+/* sink for the download of the metadata archive: decompresses it (unless cURL
+ * already did, e.g. it was sent with a Content-Encoding) into the parser */
+static gboolean
+parse_archive (const char *chunk, size_t len, archive_t *archive, GError **error)
+{
+    if (!archive->is_detected)
+    {
+        archive->is_detected = TRUE;
+        if (len >= 2 && (guchar) chunk[0] == 0x1f && (guchar) chunk[1] == 0x8b)
+        {
+            /* 16: gzip format */
+            if (inflateInit2 (&archive->zs, 16 + MAX_WBITS) != Z_OK)
             {
-                const char hex[] = "0123456789ABCDEF";
-
-                if (max < 3)
-                {
-                    /* add url until this pkg and start a new one */
-                    *end = '\0';
-                    urls = alpm_list_add (urls, strdup (buf));
-                    max = MAX_URL_LENGTH;
-                    s = buf;
-                    add (AUR_URL_PREFIX);
-                    /* reset to start this pkgname over */
-                    end = s;
-                    add (AUR_URL_PREFIX_PKG);
-                    p = pkgname - 1;
-                    continue;
-                }
-                /* Credit to Fred Bullback for the following */
-                *s++ = '%';
-                *s++ = hex[*p >> 4];
-                *s++ = hex[*p & 15];
-                max -= 3;
+                g_set_error (error, KALU_ERROR, 8,
+                        _("Unable to decompress AUR metadata: %s"),
+                        (archive->zs.msg) ? archive->zs.msg : "init failed");
+                return FALSE;
             }
+            archive->is_gzip = TRUE;
         }
-        *s = '\0';
     }
-    urls = alpm_list_add (urls, strdup (buf));
 
-    /* download */
-    FOR_LIST (i, urls)
+    if (!archive->is_gzip)
     {
-        data = curl_download (i->data, &local_err);
-        if (local_err != NULL)
+        return aur_json_feed (archive->json, chunk, len, error);
+    }
+    else if (archive->is_end)
+    {
+        return TRUE;
+    }
+
+    archive->zs.next_in = (Bytef *) chunk;
+    archive->zs.avail_in = (uInt) len;
+    do
+    {
+        int ret;
+
+        archive->zs.next_out = (Bytef *) archive->out;
+        archive->zs.avail_out = sizeof (archive->out);
+        ret = inflate (&archive->zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
         {
-            g_propagate_error (error, local_err);
-            FREELIST (urls);
-            FREE_PACKAGE_LIST (*packages);
-            alpm_list_free (list_nf);
+            g_set_error (error, KALU_ERROR, 8,
+                    _("Unable to decompress AUR metadata: %s"),
+                    (archive->zs.msg) ? archive->zs.msg : "corrupted data");
             return FALSE;
         }
 
-        /* parse json */
-        debug ("parsing json");
-        json = cJSON_Parse (data);
-	debug("JSON %s", data);
-        if (!json)
+        if (!aur_json_feed (archive->json, archive->out,
+                    sizeof (archive->out) - archive->zs.avail_out, error))
         {
-            debug ("invalid json");
-            g_set_error (error, KALU_ERROR, 8,
-                    _("Invalid JSON response from the AUR"));
-            FREELIST (urls);
-            FREE_PACKAGE_LIST (*packages);
-            alpm_list_free (list_nf);
-            free (data);
             return FALSE;
         }
 
-        results = cJSON_GetObjectItem (json, "results");
-        c = cJSON_GetArraySize (results);
-        debug ("got %d results", c);
-        for (j = 0; j < c; ++j)
+        if (ret == Z_STREAM_END)
         {
-            package = cJSON_GetArrayItem (results, j);
-            if (package)
-            {
-                /* AUR */
-                pkgname = cJSON_GetObjectItem (package, "Name")->valuestring;
-                pkgdesc = cJSON_GetObjectItem (package, "Description")->valuestring;
-                /* because desc is not required */
-                if (!pkgdesc)
-                    pkgdesc = "";
-                pkgver = cJSON_GetObjectItem (package, "Version")->valuestring;
-                /* ALPM/watched */
-                pkg = get_pkg_from_list (pkgname, aur_pkgs, is_watched);
-                if (!pkg)
-                {
-                    debug ("package %s not found in aur_pkgs", pkgname);
-                    g_set_error (error, KALU_ERROR, 8,
-                            _("Unexpected results from the AUR [%s]"),
-                            pkgname);
-                    FREELIST (urls);
-                    FREE_PACKAGE_LIST (*packages);
-                    alpm_list_free (list_nf);
-                    free (data);
-                    cJSON_Delete (json);
-                    return FALSE;
-                }
-                /* remove from list of not found packages */
-                if (list_nf)
-                {
-                    struct {
-                        gboolean is_watched;
-                        const gchar *pkgname;
-                    } find_data = { is_watched, pkgname };
-                    list_nf = alpm_list_remove (list_nf, &find_data,
-                            (alpm_list_fn_cmp) find_nf, NULL);
-                }
-                if (is_watched)
-                {
-                    oldver = ((watched_package_t *) pkg)->version;
-                }
-                else
-                {
-                    oldver = alpm_pkg_get_version ((alpm_pkg_t *) pkg);
-                }
-                /* is AUR newer? */
-                if (alpm_pkg_vercmp (pkgver, oldver) == 1)
-                {
-                    debug ("%s %s -> %s", pkgname, oldver, pkgver);
-                    kpkg = new0 (kalu_package_t, 1);
-                    kpkg->name = strdup (pkgname);
-                    kpkg->desc = strdup (pkgdesc);
-                    kpkg->old_version = strdup (oldver);
-                    kpkg->new_version = strdup (pkgver);
-		    kpkg->ignored = 1; // TODO: Determine this!
-                    *packages = alpm_list_add (*packages, kpkg);
-                }
-            }
+            archive->is_end = TRUE;
+            break;
         }
-        cJSON_Delete (json);
-        free (data);
+        else if (ret == Z_BUF_ERROR)
+        {
+            /* no progress possible, i.e. needs more input */
+            break;
+        }
+    }
+    while (archive->zs.avail_in > 0 || archive->zs.avail_out == 0);
+
+    return TRUE;
+}
+
+static void
+free_archive (archive_t *archive, const char *file_tmp)
+{
+    if (archive->is_gzip)
+    {
+        inflateEnd (&archive->zs);
+    }
+    if (archive->fp)
+    {
+        fclose (archive->fp);
+        unlink (file_tmp);
     }
-    FREELIST (urls);
+    aur_json_free (archive->json);
+    free (archive);
+}
+
+/* gets info from the AUR's metadata archive, i.e. info about all packages at
+ * once, which gets turned into an index kept in cache. On auto checks, the
+ * index is used as long as it isn't older than the TTL of the AUR cache, else
+ * it is only downloaded again if modified */
+static gboolean
+query_archive (aur_query_t *query, gboolean use_cache, GError **error)
+{
+    char file[PATH_MAX], file_tmp[PATH_MAX];
+    struct stat st;
+    archive_t *archive;
+    gboolean is_modified;
+    GError *local_err = NULL;
+    GHashTableIter iter;
+    gpointer pkgname;
 
-    /* turn not_found into a list of kalu_package_t as it should be, or add them
-     * to packages (if not_found is NULL, i.e. is_watched is TRUE) */
-    if (list_nf)
+    if (!query->infos)
     {
-        FOR_LIST (i, list_nf)
+        query->infos = new_infos ();
+        g_hash_table_iter_init (&iter, query->wanted);
+        while (g_hash_table_iter_next (&iter, &pkgname, NULL))
         {
-            kpkg = new0 (kalu_package_t, 1);
+            g_hash_table_add (query->queried, pkgname);
+        }
+    }
 
-            if (is_watched)
-            {
-                watched_package_t *wp = i->data;
+    get_index_file (file);
+    if (use_cache && config->aur_cache_ttl > 0 && stat (file, &st) == 0
+            && query->now - (gint64) st.st_mtime < (gint64) config->aur_cache_ttl
+            && load_index (query, file))
+    {
+        debug ("using AUR index %s", file);
+        return TRUE;
+    }
 
-                kpkg->name = strdup (wp->name);
-                kpkg->desc = strdup (_("<package not found>"));
-                kpkg->old_version = strdup (wp->version);
-                kpkg->new_version = strdup ("-");
-            }
-            else
-            {
-                alpm_pkg_t *p = i->data;
+    archive = new0 (archive_t, 1);
+    archive->query = query;
+    archive->json = aur_json_new ((aur_json_pkg_fn) add_archive_pkg, archive);
+    snprintf (file_tmp, PATH_MAX, "%s.tmp", file);
+    if (ensure_path (file_tmp))
+    {
+        archive->fp = fopen (file_tmp, "w");
+    }
+    if (archive->fp)
+    {
+        fputs (AUR_ARCHIVE_INDEX_MAGIC, archive->fp);
+    }
+    else
+    {
+        debug ("unable to write AUR index %s", file_tmp);
+    }
 
-                kpkg->name = strdup (alpm_pkg_get_name (p));
-                kpkg->desc = strdup (alpm_pkg_get_desc (p));
-                kpkg->old_version = strdup (alpm_pkg_get_version (p));
-            }
+    if (!curl_download_revalidate (AUR_URL_ARCHIVE, AUR_ARCHIVE_INDEX,
+                (curl_sink_fn) parse_archive, archive, &is_modified, &local_err))
+    {
+        g_propagate_error (error, local_err);
+        free_archive (archive, file_tmp);
+        return FALSE;
+    }
 
-            if (not_found)
-            {
-                debug ("adding to not found: package %s", kpkg->name);
-                *not_found = alpm_list_add (*not_found, kpkg);
-            }
-            else
+    if (!is_modified)
+    {
+        free_archive (archive, file_tmp);
+        if (load_index (query, file))
+        {
+            /* so it's good for another TTL */
+            utime (file, NULL);
+            return TRUE;
+        }
+        /* no (valid) index after all, so download everything again */
+        unlink (file);
+        return query_archive (query, FALSE, error);
+    }
+
+    if ((archive->is_gzip && !archive->is_end)
+            || !aur_json_end (archive->json, &local_err))
+    {
+        if (!local_err)
+        {
+            g_set_error (&local_err, KALU_ERROR, 8,
+                    _("Unable to decompress AUR metadata: %s"),
+                    "unexpected end of data");
+        }
+        g_propagate_error (error, local_err);
+        free_archive (archive, file_tmp);
+        /* validators were saved for a content we don't have */
+        unlink (file);
+        return FALSE;
+    }
+    debug ("got %u packages from AUR metadata archive", archive->nb_pkgs);
+
+    if (archive->fp)
+    {
+        gboolean is_ok;
+
+        is_ok = !ferror (archive->fp);
+        is_ok = (fclose (archive->fp) == 0) && is_ok;
+        archive->fp = NULL;
+        if (!is_ok || rename (file_tmp, file) != 0)
+        {
+            debug ("unable to save AUR index %s", file);
+            unlink (file_tmp);
+            unlink (file);
+        }
+    }
+    else
+    {
+        unlink (file);
+    }
+    free_archive (archive, file_tmp);
+
+    return TRUE;
+}
+
+static gboolean
+use_archive (guint nb_pkgs)
+{
+    switch (config->aur_backend)
+    {
+        case AUR_BACKEND_RPC:
+            return FALSE;
+        case AUR_BACKEND_ARCHIVE:
+            return TRUE;
+        case AUR_BACKEND_AUTO:
+        default:
+            return nb_pkgs >= (guint) config->aur_archive_threshold;
+    }
+}
+
+aur_results_t *
+aur_query (alpm_list_t  *aur_pkgs,
+           alpm_list_t  *watched_aur,
+           gboolean      use_cache,
+           GError      **error)
+{
+    alpm_list_t *i;
+    GHashTableIter iter;
+    const char *pkgname;
+    gboolean is_archive;
+    gboolean is_ok;
+    aur_results_t *results;
+    aur_query_t query;
+
+    /* each package is only looked up once, even if it is both foreign and
+     * watched; the local version is then the one used to validate cache */
+    query.wanted = g_hash_table_new (g_str_hash, g_str_equal);
+    for (i = aur_pkgs; i; i = alpm_list_next (i))
+    {
+        alpm_pkg_t *pkg = i->data;
+
+        g_hash_table_insert (query.wanted, (gpointer) alpm_pkg_get_name (pkg),
+                (gpointer) alpm_pkg_get_version (pkg));
+    }
+    for (i = watched_aur; i; i = alpm_list_next (i))
+    {
+        watched_package_t *wp = i->data;
+
+        if (!g_hash_table_lookup (query.wanted, wp->name))
+        {
+            g_hash_table_insert (query.wanted, wp->name, wp->version);
+        }
+    }
+
+    query.queried = g_hash_table_new (g_str_hash, g_str_equal);
+    query.infos = NULL;
+    query.now = g_get_real_time () / G_USEC_PER_SEC;
+
+    is_archive = use_archive (g_hash_table_size (query.wanted));
+    debug ("looking for AUR updates (%u packages, using %s)",
+            g_hash_table_size (query.wanted),
+            (is_archive) ? "metadata archive" : "RPC");
+    if (is_archive)
+    {
+        is_ok = query_archive (&query, use_cache, error);
+    }
+    else
+    {
+        is_ok = query_rpc (&query, use_cache, error);
+    }
+    if (!is_ok)
+    {
+        g_hash_table_unref (query.wanted);
+        g_hash_table_unref (query.queried);
+        g_hash_table_unref (query.infos);
+        return NULL;
+    }
+
+    /* also remember packages that weren't found */
+    g_hash_table_iter_init (&iter, query.queried);
+    while (g_hash_table_iter_next (&iter, (gpointer) &pkgname, NULL))
+    {
+        set_info (&query, pkgname, NULL, NULL);
+    }
+    /* the metadata archive is its own cache */
+    if (!is_archive && config->aur_cache_ttl > 0)
+    {
+        save_cache (query.infos, query.now);
+    }
+    g_hash_table_unref (query.wanted);
+    g_hash_table_unref (query.queried);
+
+    results = new0 (aur_results_t, 1);
+    results->infos = query.infos;
+    return results;
+}
+
+gboolean
+aur_has_updates (alpm_list_t    **packages,
+                 alpm_list_t    **not_found,
+                 alpm_list_t     *aur_pkgs,
+                 gboolean         is_watched,
+                 aur_results_t   *results)
+{
+    alpm_list_t *i;
+    const char *pkgname, *oldver;
+    aur_info_t *info;
+    kalu_package_t *kpkg;
+
+    debug ((is_watched)
+            ? "matching Watched AUR updates"
+            : "matching AUR updates");
+
+    for (i = aur_pkgs; i; i = alpm_list_next (i))
+    {
+        if (is_watched)
+        {
+            pkgname = ((watched_package_t *) i->data)->name;
+            oldver = ((watched_package_t *) i->data)->version;
+        }
+        else
+        {
+            pkgname = alpm_pkg_get_name ((alpm_pkg_t *) i->data);
+            oldver = alpm_pkg_get_version ((alpm_pkg_t *) i->data);
+        }
+
+        info = g_hash_table_lookup (results->infos, pkgname);
+        if (info && info->version)
+        {
+            /* is AUR newer? */
+            if (alpm_pkg_vercmp (info->version, oldver) == 1)
             {
-                debug ("not found: %s", kpkg->name);
+                debug ("%s %s -> %s", pkgname, oldver, info->version);
+                kpkg = new0 (kalu_package_t, 1);
+                kpkg->name = strdup (pkgname);
+                kpkg->desc = strdup (info->desc);
+                kpkg->old_version = strdup (oldver);
+                kpkg->new_version = strdup (info->version);
+		kpkg->ignored = 1; // TODO: Determine this!
                 *packages = alpm_list_add (*packages, kpkg);
             }
+            continue;
+        }
+
+        /* turn not found packages into a list of kalu_package_t as it should
+         * be, or add them to packages (if not_found is NULL, i.e. is_watched
+         * is TRUE) */
+        if (!not_found && !is_watched)
+        {
+            continue;
+        }
+
+        kpkg = new0 (kalu_package_t, 1);
+
+        if (is_watched)
+        {
+            kpkg->name = strdup (pkgname);
+            kpkg->desc = strdup (_("<package not found>"));
+            kpkg->old_version = strdup (oldver);
+            kpkg->new_version = strdup ("-");
+        }
+        else
+        {
+            alpm_pkg_t *p = i->data;
+
+            kpkg->name = strdup (pkgname);
+            kpkg->desc = strdup (alpm_pkg_get_desc (p));
+            kpkg->old_version = strdup (oldver);
+        }
+
+        if (not_found)
+        {
+            debug ("adding to not found: package %s", kpkg->name);
+            *not_found = alpm_list_add (*not_found, kpkg);
+        }
+        else
+        {
+            debug ("not found: %s", kpkg->name);
+            *packages = alpm_list_add (*packages, kpkg);
         }
-        alpm_list_free (list_nf);
     }
 
     return (*packages != NULL);
 }
-#undef add
+
+void
+aur_free_results (aur_results_t *results)
+{
+    g_hash_table_unref (results->infos);
+    free (results);
+}
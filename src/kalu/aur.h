@@ -23,11 +23,22 @@
 #ifndef _KALU_AUR_H
 #define _KALU_AUR_H
 
+typedef struct _aur_results_t aur_results_t;
+
+aur_results_t *
+aur_query (alpm_list_t  *aur_pkgs,
+           alpm_list_t  *watched_aur,
+           gboolean      use_cache,
+           GError      **error);
+
 gboolean
-aur_has_updates (alpm_list_t **packages,
-                 alpm_list_t **not_found,
-                 alpm_list_t *aur_pkgs,
-                 gboolean is_watched,
-                 GError **error);
+aur_has_updates (alpm_list_t    **packages,
+                 alpm_list_t    **not_found,
+                 alpm_list_t     *aur_pkgs,
+                 gboolean         is_watched,
+                 aur_results_t   *results);
+
+void
+aur_free_results (aur_results_t *results);
 
 #endif /* _KALU_AUR_H */
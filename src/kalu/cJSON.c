@@ -69,21 +69,102 @@ void cJSON_InitHooks(cJSON_Hooks* hooks)
 	cJSON_free	 = (hooks->free_fn)?hooks->free_fn:free;
 }
 
+/* Arena of the trees from cJSON_ParseArena: nodes & indexes are bump allocated from a few blocks, all freed at once. */
+#define CJSON_ARENA_BLOCK	4096	/* Minimum size of a block. */
+#define CJSON_ARENA_ALIGN(sz)	(((sz)+7)&~(size_t)7)
+typedef struct cJSON_ArenaBlock {
+	struct cJSON_ArenaBlock *next;
+} cJSON_ArenaBlock;
+typedef struct cJSON_Arena {
+	cJSON_ArenaBlock *blocks;	/* Most recent first; The arena itself lives in the last one. */
+	char *ptr,*end;				/* Free space in the current block. */
+	size_t next_size;			/* Size of the next block, doubled every time. */
+	cJSON *root;				/* The only node cJSON_Delete acts upon. */
+} cJSON_Arena;
+
+static void *cJSON_ArenaAlloc(cJSON_Arena *a,size_t sz)
+{
+	char *p;sz=CJSON_ARENA_ALIGN(sz);
+	if ((size_t)(a->end-a->ptr)<sz)
+	{
+		cJSON_ArenaBlock *b;size_t size=a->next_size;
+		while (size<sz) size*=2;
+		b=(cJSON_ArenaBlock*)cJSON_malloc(CJSON_ARENA_ALIGN(sizeof(cJSON_ArenaBlock))+size);
+		if (!b) return 0;
+		b->next=a->blocks;a->blocks=b;
+		a->ptr=(char*)b+CJSON_ARENA_ALIGN(sizeof(cJSON_ArenaBlock));a->end=a->ptr+size;
+		a->next_size=size*2;
+	}
+	p=a->ptr;a->ptr+=sz;
+	return p;
+}
+
+static void cJSON_FreeArena(cJSON_Arena *a)
+{
+	cJSON_ArenaBlock *b=a->blocks,*next;
+	while (b) {next=b->next;cJSON_free(b);b=next;}
+}
+
 /* Internal constructor. */
-static cJSON *cJSON_New_Item(void)
+static cJSON *cJSON_New_Item(cJSON_Arena *a)
 {
-	cJSON* node = (cJSON*)cJSON_malloc(sizeof(cJSON));
-	if (node) memset(node,0,sizeof(cJSON));
+	cJSON* node = (cJSON*)(a?cJSON_ArenaAlloc(a,sizeof(cJSON)):cJSON_malloc(sizeof(cJSON)));
+	if (node) {memset(node,0,sizeof(cJSON));node->arena=a;}
 	return node;
 }
 
+/* Hashed index of the children of an object, by (case insensitive) name. */
+#define CJSON_INDEX_MIN 16	/* Objects with fewer items are just scanned. */
+typedef struct cJSON_Index {
+	unsigned mask;			/* Number of slots - 1 (a power of 2). */
+	cJSON *slots[1];		/* Open addressing, linear probing. */
+} cJSON_Index;
+
+static unsigned cJSON_hash(const char *s)
+{
+	unsigned h=5381;
+	while (*s) h=h*33+(unsigned)tolower(*(const unsigned char *)s++);
+	return h;
+}
+
+static void cJSON_DropIndex(cJSON *object) {if (object->index && !object->arena) cJSON_free(object->index);object->index=0;}
+
+/* Builds the index of an object with nb items; On duplicates the first one wins, as with a scan. */
+static void cJSON_BuildIndex(cJSON *object,int nb)
+{
+	cJSON_Index *index;cJSON *c;unsigned size=1,i;size_t sz;
+	while (size<(unsigned)nb*2) size<<=1;
+	sz=sizeof(cJSON_Index)+(size-1)*sizeof(cJSON*);
+	index=(cJSON_Index*)(object->arena?cJSON_ArenaAlloc(object->arena,sz):cJSON_malloc(sz));
+	if (!index) return;
+	memset(index->slots,0,size*sizeof(cJSON*));
+	index->mask=size-1;
+	for (c=object->child;c;c=c->next)
+	{
+		if (!c->string) continue;
+		for (i=cJSON_hash(c->string)&index->mask;index->slots[i] && cJSON_strcasecmp(index->slots[i]->string,c->string);i=(i+1)&index->mask);
+		if (!index->slots[i]) index->slots[i]=c;
+	}
+	object->index=index;
+}
+
+static cJSON *cJSON_IndexLookup(cJSON_Index *index,const char *string)
+{
+	unsigned i;
+	for (i=cJSON_hash(string)&index->mask;index->slots[i];i=(i+1)&index->mask)
+		if (!cJSON_strcasecmp(index->slots[i]->string,string)) return index->slots[i];
+	return 0;
+}
+
 /* Delete a cJSON structure. */
 void cJSON_Delete(cJSON *c)
 {
 	cJSON *next;
+	if (c && c->arena) {if (c==c->arena->root) cJSON_FreeArena(c->arena);return;}	/* All in one go. */
 	while (c)
 	{
 		next=c->next;
+		cJSON_DropIndex(c);
 		if (!(c->type&cJSON_IsReference) && c->child) cJSON_Delete(c->child);
 		if (!(c->type&cJSON_IsReference) && c->valuestring) cJSON_free(c->valuestring);
 		if (c->string) cJSON_free(c->string);
@@ -140,17 +221,26 @@ static char *print_number(cJSON *item)
 
 /* Parse the input text into an unescaped cstring, and populate item. */
 static const unsigned char firstByteMark[7] = { 0x00, 0x00, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
-static const char *parse_string(cJSON *item,const char *str)
+static const char *parse_string(cJSON *item,const char *str,cJSON_Arena *a)
 {
 	const char *ptr=str+1;char *ptr2;char *out;int len=0;unsigned uc,uc2;
 	if (*str!='\"') {ep=str;return 0;}	/* not a string! */
 	
-	while (*ptr!='\"' && *ptr) {++len; if (*ptr++ == '\\') ptr++;}	/* Skip escaped quotes. */
-	
-	out=(char*)cJSON_malloc((size_t)(len+1));	/* This is how long we need for the string, roughly. */
-	if (!out) return 0;
-	
-	ptr=str+1;ptr2=out;
+	if (a)	/* Unescape in place (it never grows), so strings are views into the input. */
+	{
+		out=(char*)str+1;
+		while (*ptr!='\"' && *ptr && *ptr!='\\') ptr++;	/* Nothing to move until the first escape. */
+		ptr2=(char*)ptr;
+	}
+	else
+	{
+		while (*ptr!='\"' && *ptr) {++len; if (*ptr++ == '\\') ptr++;}	/* Skip escaped quotes. */
+		
+		out=(char*)cJSON_malloc((size_t)(len+1));	/* This is how long we need for the string, roughly. */
+		if (!out) return 0;
+		
+		ptr=str+1;ptr2=out;
+	}
 	while (*ptr!='\"' && *ptr)
 	{
 		if (*ptr!='\\') *ptr2++=*ptr++;
@@ -192,8 +282,8 @@ static const char *parse_string(cJSON *item,const char *str)
 			ptr++;
 		}
 	}
-	*ptr2=0;
 	if (*ptr=='\"') ptr++;
+	*ptr2=0;	/* In place, this can be where the closing quote was. */
 	item->valuestring=out;
 	item->type=cJSON_String;
 	return ptr;
@@ -239,11 +329,11 @@ static char *print_string_ptr(const char *str)
 static char *print_string(cJSON *item)	{return print_string_ptr(item->valuestring);}
 
 /* Predeclare these prototypes. */
-static const char *parse_value(cJSON *item,const char *value);
+static const char *parse_value(cJSON *item,const char *value,cJSON_Arena *a);
 static char *print_value(cJSON *item,int depth,int fmt);
-static const char *parse_array(cJSON *item,const char *value);
+static const char *parse_array(cJSON *item,const char *value,cJSON_Arena *a);
 static char *print_array(cJSON *item,int depth,int fmt);
-static const char *parse_object(cJSON *item,const char *value);
+static const char *parse_object(cJSON *item,const char *value,cJSON_Arena *a);
 static char *print_object(cJSON *item,int depth,int fmt);
 
 /* Utility to jump whitespace and cr/lf */
@@ -252,11 +342,26 @@ static const char *skip(const char *in) {while (in && *in && (unsigned char)*in<
 /* Parse an object - create a new root, and populate. */
 cJSON *cJSON_Parse(const char *value)
 {
-	cJSON *c=cJSON_New_Item();
+	cJSON *c=cJSON_New_Item(0);
 	ep=0;
 	if (!c) return 0;       /* memory fail */
 
-	if (!parse_value(c,skip(value))) {cJSON_Delete(c);return 0;}
+	if (!parse_value(c,skip(value),0)) {cJSON_Delete(c);return 0;}
+	return c;
+}
+
+/* Parse into an arena, in place. */
+cJSON *cJSON_ParseArena(char *value)
+{
+	cJSON_Arena tmp,*a;cJSON *c;size_t size=strlen(value)*2;
+	memset(&tmp,0,sizeof(cJSON_Arena));
+	tmp.next_size=(size>CJSON_ARENA_BLOCK)?size:CJSON_ARENA_BLOCK;	/* Nodes usually take about that much. */
+	ep=0;
+	if (!(a=(cJSON_Arena*)cJSON_ArenaAlloc(&tmp,sizeof(cJSON_Arena)))) return 0;	/* memory fail */
+	*a=tmp;
+	if (!(c=a->root=cJSON_New_Item(a))) {cJSON_FreeArena(a);return 0;}
+
+	if (!parse_value(c,skip(value),a)) {cJSON_FreeArena(a);return 0;}
 	return c;
 }
 
@@ -265,16 +370,16 @@ char *cJSON_Print(cJSON *item)				{return print_value(item,0,1);}
 char *cJSON_PrintUnformatted(cJSON *item)	{return print_value(item,0,0);}
 
 /* Parser core - when encountering text, process appropriately. */
-static const char *parse_value(cJSON *item,const char *value)
+static const char *parse_value(cJSON *item,const char *value,cJSON_Arena *a)
 {
 	if (!value)						return 0;	/* Fail on null. */
 	if (!strncmp(value,"null",4))	{ item->type=cJSON_NULL;  return value+4; }
 	if (!strncmp(value,"false",5))	{ item->type=cJSON_False; return value+5; }
 	if (!strncmp(value,"true",4))	{ item->type=cJSON_True; item->valueint=1;	return value+4; }
-	if (*value=='\"')				{ return parse_string(item,value); }
+	if (*value=='\"')				{ return parse_string(item,value,a); }
 	if (*value=='-' || (*value>='0' && *value<='9'))	{ return parse_number(item,value); }
-	if (*value=='[')				{ return parse_array(item,value); }
-	if (*value=='{')				{ return parse_object(item,value); }
+	if (*value=='[')				{ return parse_array(item,value,a); }
+	if (*value=='{')				{ return parse_object(item,value,a); }
 
 	ep=value;return 0;	/* failure. */
 }
@@ -298,7 +403,7 @@ static char *print_value(cJSON *item,int depth,int fmt)
 }
 
 /* Build an array from input text. */
-static const char *parse_array(cJSON *item,const char *value)
+static const char *parse_array(cJSON *item,const char *value,cJSON_Arena *a)
 {
 	cJSON *child;
 	if (*value!='[')	{ep=value;return 0;}	/* not an array! */
@@ -307,17 +412,17 @@ static const char *parse_array(cJSON *item,const char *value)
 	value=skip(value+1);
 	if (*value==']') return value+1;	/* empty array. */
 
-	item->child=child=cJSON_New_Item();
+	item->child=child=cJSON_New_Item(a);
 	if (!item->child) return 0;		 /* memory fail */
-	value=skip(parse_value(child,skip(value)));	/* skip any spacing, get the value. */
+	value=skip(parse_value(child,skip(value),a));	/* skip any spacing, get the value. */
 	if (!value) return 0;
 
 	while (*value==',')
 	{
 		cJSON *new_item;
-		if (!(new_item=cJSON_New_Item())) return 0; 	/* memory fail */
+		if (!(new_item=cJSON_New_Item(a))) return 0; 	/* memory fail */
 		child->next=new_item;new_item->prev=child;child=new_item;
-		value=skip(parse_value(child,skip(value+1)));
+		value=skip(parse_value(child,skip(value+1),a));
 		if (!value) return 0;	/* memory fail */
 	}
 
@@ -377,7 +482,7 @@ static char *print_array(cJSON *item,int depth,int fmt)
 }
 
 /* Build an object from the text. */
-static const char *parse_object(cJSON *item,const char *value)
+static const char *parse_object(cJSON *item,const char *value,cJSON_Arena *a)
 {
 	cJSON *child;
 	if (*value!='{')	{ep=value;return 0;}	/* not an object! */
@@ -386,25 +491,25 @@ static const char *parse_object(cJSON *item,const char *value)
 	value=skip(value+1);
 	if (*value=='}') return value+1;	/* empty array. */
 	
-	item->child=child=cJSON_New_Item();
+	item->child=child=cJSON_New_Item(a);
 	if (!item->child) return 0;
-	value=skip(parse_string(child,skip(value)));
+	value=skip(parse_string(child,skip(value),a));
 	if (!value) return 0;
 	child->string=child->valuestring;child->valuestring=0;
 	if (*value!=':') {ep=value;return 0;}	/* fail! */
-	value=skip(parse_value(child,skip(value+1)));	/* skip any spacing, get the value. */
+	value=skip(parse_value(child,skip(value+1),a));	/* skip any spacing, get the value. */
 	if (!value) return 0;
 	
 	while (*value==',')
 	{
 		cJSON *new_item;
-		if (!(new_item=cJSON_New_Item()))	return 0; /* memory fail */
+		if (!(new_item=cJSON_New_Item(a)))	return 0; /* memory fail */
 		child->next=new_item;new_item->prev=child;child=new_item;
-		value=skip(parse_string(child,skip(value+1)));
+		value=skip(parse_string(child,skip(value+1),a));
 		if (!value) return 0;
 		child->string=child->valuestring;child->valuestring=0;
 		if (*value!=':') {ep=value;return 0;}	/* fail! */
-		value=skip(parse_value(child,skip(value+1)));	/* skip any spacing, get the value. */
+		value=skip(parse_value(child,skip(value+1),a));	/* skip any spacing, get the value. */
 		if (!value) return 0;
 	}
 	
@@ -473,40 +578,51 @@ static char *print_object(cJSON *item,int depth,int fmt)
 /* Get Array size/item / object item. */
 int    cJSON_GetArraySize(cJSON *array)							{cJSON *c=array->child;int i=0;while(c)i++,c=c->next;return i;}
 cJSON *cJSON_GetArrayItem(cJSON *array,int item)				{cJSON *c=array->child;  while (c && item-->0) c=c->next; return c;}
-cJSON *cJSON_GetObjectItem(cJSON *object,const char *string)	{cJSON *c=object->child; while (c && cJSON_strcasecmp(c->string,string)) c=c->next; return c;}
+cJSON *cJSON_GetObjectItem(cJSON *object,const char *string)
+{
+	cJSON *c,*found;int nb=0;
+	if (object->index) return cJSON_IndexLookup(object->index,string);
+	for (c=object->child; c && cJSON_strcasecmp(c->string,string); c=c->next) nb++;
+	if (nb<CJSON_INDEX_MIN) return c;
+	/* Scanned through many items: index them all, for next lookups. */
+	for (found=c; c; c=c->next) nb++;
+	cJSON_BuildIndex(object,nb);
+	return found;
+}
 
 /* Utility for array list handling. */
 static void suffix_object(cJSON *prev,cJSON *item) {prev->next=item;item->prev=prev;}
 /* Utility for handling references. */
-static cJSON *create_reference(cJSON *item) {cJSON *ref=cJSON_New_Item();if (!ref) return 0;memcpy(ref,item,sizeof(cJSON));ref->string=0;ref->type|=cJSON_IsReference;ref->next=ref->prev=0;return ref;}
+static cJSON *create_reference(cJSON *item) {cJSON *ref=cJSON_New_Item(0);if (!ref) return 0;memcpy(ref,item,sizeof(cJSON));ref->string=0;ref->index=0;ref->arena=0;ref->type|=cJSON_IsReference;ref->next=ref->prev=0;return ref;}
 
 /* Add item to array/object. */
-void   cJSON_AddItemToArray(cJSON *array, cJSON *item)						{cJSON *c=array->child;if (!item) return; if (!c) {array->child=item;} else {while (c && c->next) c=c->next; suffix_object(c,item);}}
+void   cJSON_AddItemToArray(cJSON *array, cJSON *item)						{cJSON *c=array->child;if (!item) return; cJSON_DropIndex(array); if (!c) {array->child=item;} else {while (c && c->next) c=c->next; suffix_object(c,item);}}
+void   cJSON_AddItemToArrayAfter(cJSON *array,cJSON *last,cJSON *item)	{if (!item) return; cJSON_DropIndex(array); if (!last) array->child=item; else suffix_object(last,item);}
 void   cJSON_AddItemToObject(cJSON *object,const char *string,cJSON *item)	{if (!item) return; if (item->string) cJSON_free(item->string);item->string=cJSON_strdup(string);cJSON_AddItemToArray(object,item);}
 void	cJSON_AddItemReferenceToArray(cJSON *array, cJSON *item)						{cJSON_AddItemToArray(array,create_reference(item));}
 void	cJSON_AddItemReferenceToObject(cJSON *object,const char *string,cJSON *item)	{cJSON_AddItemToObject(object,string,create_reference(item));}
 
-cJSON *cJSON_DetachItemFromArray(cJSON *array,int which)			{cJSON *c=array->child;while (c && which-->0) c=c->next;if (!c) return 0;
+cJSON *cJSON_DetachItemFromArray(cJSON *array,int which)			{cJSON *c=array->child;while (c && which-->0) c=c->next;if (!c) return 0;cJSON_DropIndex(array);
 	if (c->prev) c->prev->next=c->next;if (c->next) c->next->prev=c->prev;if (c==array->child) array->child=c->next;c->prev=c->next=0;return c;}
 void   cJSON_DeleteItemFromArray(cJSON *array,int which)			{cJSON_Delete(cJSON_DetachItemFromArray(array,which));}
 cJSON *cJSON_DetachItemFromObject(cJSON *object,const char *string) {int i=0;cJSON *c=object->child;while (c && cJSON_strcasecmp(c->string,string)) i++,c=c->next;if (c) return cJSON_DetachItemFromArray(object,i);return 0;}
 void   cJSON_DeleteItemFromObject(cJSON *object,const char *string) {cJSON_Delete(cJSON_DetachItemFromObject(object,string));}
 
 /* Replace array/object items with new ones. */
-void   cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c=array->child;while (c && which-->0) c=c->next;if (!c) return;
+void   cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c=array->child;while (c && which-->0) c=c->next;if (!c) return;cJSON_DropIndex(array);
 	newitem->next=c->next;newitem->prev=c->prev;if (newitem->next) newitem->next->prev=newitem;
 	if (c==array->child) array->child=newitem; else newitem->prev->next=newitem;c->next=c->prev=0;cJSON_Delete(c);}
 void   cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem){int i=0;cJSON *c=object->child;while(c && cJSON_strcasecmp(c->string,string))i++,c=c->next;if(c){newitem->string=cJSON_strdup(string);cJSON_ReplaceItemInArray(object,i,newitem);}}
 
 /* Create basic types: */
-cJSON *cJSON_CreateNull()						{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_NULL;return item;}
-cJSON *cJSON_CreateTrue()						{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_True;return item;}
-cJSON *cJSON_CreateFalse()						{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_False;return item;}
-cJSON *cJSON_CreateBool(int b)					{cJSON *item=cJSON_New_Item();if(item)item->type=b?cJSON_True:cJSON_False;return item;}
-cJSON *cJSON_CreateNumber(double num)			{cJSON *item=cJSON_New_Item();if(item){item->type=cJSON_Number;item->valuedouble=num;item->valueint=(int)num;}return item;}
-cJSON *cJSON_CreateString(const char *string)	{cJSON *item=cJSON_New_Item();if(item){item->type=cJSON_String;item->valuestring=cJSON_strdup(string);}return item;}
-cJSON *cJSON_CreateArray()						{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_Array;return item;}
-cJSON *cJSON_CreateObject()						{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_Object;return item;}
+cJSON *cJSON_CreateNull()						{cJSON *item=cJSON_New_Item(0);if(item)item->type=cJSON_NULL;return item;}
+cJSON *cJSON_CreateTrue()						{cJSON *item=cJSON_New_Item(0);if(item)item->type=cJSON_True;return item;}
+cJSON *cJSON_CreateFalse()						{cJSON *item=cJSON_New_Item(0);if(item)item->type=cJSON_False;return item;}
+cJSON *cJSON_CreateBool(int b)					{cJSON *item=cJSON_New_Item(0);if(item)item->type=b?cJSON_True:cJSON_False;return item;}
+cJSON *cJSON_CreateNumber(double num)			{cJSON *item=cJSON_New_Item(0);if(item){item->type=cJSON_Number;item->valuedouble=num;item->valueint=(int)num;}return item;}
+cJSON *cJSON_CreateString(const char *string)	{cJSON *item=cJSON_New_Item(0);if(item){item->type=cJSON_String;item->valuestring=cJSON_strdup(string);}return item;}
+cJSON *cJSON_CreateArray()						{cJSON *item=cJSON_New_Item(0);if(item)item->type=cJSON_Array;return item;}
+cJSON *cJSON_CreateObject()						{cJSON *item=cJSON_New_Item(0);if(item)item->type=cJSON_Object;return item;}
 
 /* Create Arrays: */
 cJSON *cJSON_CreateIntArray(int *numbers,int count)				{int i;cJSON *n=0,*p=0,*a=cJSON_CreateArray();for(i=0;a && i<count;i++){n=cJSON_CreateNumber(numbers[i]);if(!i)a->child=n;else suffix_object(p,n);p=n;}return a;}
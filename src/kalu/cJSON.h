@@ -51,6 +51,9 @@ typedef struct cJSON {
 	double valuedouble;			/* The item's number, if type==cJSON_Number */
 
 	char *string;				/* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
+
+	struct cJSON_Index *index;	/* Hashed index of an object's children by name, built on lookup when it has many. */
+	struct cJSON_Arena *arena;	/* Set on the items of a tree from cJSON_ParseArena. */
 } cJSON;
 
 typedef struct cJSON_Hooks {
@@ -64,6 +67,9 @@ extern void cJSON_InitHooks(cJSON_Hooks* hooks);
 
 /* Supply a block of JSON, and this returns a cJSON object you can interrogate. Call cJSON_Delete when finished. */
 extern cJSON *cJSON_Parse(const char *value);
+/* Same, but the whole tree lives in a few blocks freed at once by cJSON_Delete on the root, and its strings (keys & values) are
+   unescaped in place into value, which must thus outlive it. Such a tree is read-only: don't add, detach or delete items. */
+extern cJSON *cJSON_ParseArena(char *value);
 /* Render a cJSON entity to text for transfer/storage. Free the char* when finished. */
 extern char  *cJSON_Print(cJSON *item);
 /* Render a cJSON entity to text for transfer/storage without any formatting. Free the char* when finished. */
@@ -75,9 +81,12 @@ extern void   cJSON_Delete(cJSON *c);
 extern int	  cJSON_GetArraySize(cJSON *array);
 /* Retrieve item number "item" from array "array". Returns NULL if unsuccessful. */
 extern cJSON *cJSON_GetArrayItem(cJSON *array,int item);
-/* Get item "string" from object. Case insensitive. */
+/* Get item "string" from object. Case insensitive. Objects with many items get indexed on first lookup, making further ones O(1). */
 extern cJSON *cJSON_GetObjectItem(cJSON *object,const char *string);
 
+/* Iterate over the items of an array (or object), in order. Unlike GetArrayItem in a loop, this is linear. */
+#define cJSON_ArrayForEach(element,array)	for (element=(array)?(array)->child:0; element; element=element->next)
+
 /* For analysing failed parses. This returns a pointer to the parse error. You'll probably need to look a few chars back to make sense of it. Defined when cJSON_Parse() returns 0. 0 when cJSON_Parse() succeeds. */
 extern const char *cJSON_GetErrorPtr(void);
 	
@@ -99,6 +108,8 @@ extern cJSON *cJSON_CreateStringArray(const char **strings,int count);
 
 /* Append item to the specified array/object. */
 extern void cJSON_AddItemToArray(cJSON *array, cJSON *item);
+/* Same, without walking the array: last must be its last item (0 if empty). Use this to build large arrays. */
+extern void cJSON_AddItemToArrayAfter(cJSON *array, cJSON *last, cJSON *item);
 extern void	cJSON_AddItemToObject(cJSON *object,const char *string,cJSON *item);
 /* Append reference to item to the specified array/object. Use this when you want to add an existing cJSON to a new cJSON, but don't want to corrupt your existing cJSON. */
 extern void cJSON_AddItemReferenceToArray(cJSON *array, cJSON *item);
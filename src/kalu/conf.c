@@ -41,6 +41,7 @@
 #include "kalu.h"
 #include "conf.h"
 #include "util.h"
+#include "news.h"   /* news_add_state() */
 
 /* some default values */
 #define PACMAN_ROOTDIR      "/"
@@ -257,6 +258,7 @@ parse_pacman_conf (const char       *file,
         success = FALSE;
         goto cleanup;
     }
+    pac_conf->files = alpm_list_add (pac_conf->files, strdup (file));
 
     while (fgets (line, PATH_MAX, fp))
     {
@@ -675,6 +677,7 @@ free_pacman_config (pacman_config_t *pac_conf)
 
     /* non-alpm */
     FREELIST (pac_conf->syncfirst);
+    FREELIST (pac_conf->files);
 
     /* dbs/repos */
     alpm_list_t *i;
@@ -992,6 +995,10 @@ parse_config_file (const char       *file,
                 {
                     setrepeatingoption (value, "aur_ignore", &(config->aur_ignore));
                 }
+                else if (streq (key, "NewsFeeds"))
+                {
+                    setrepeatingoption (value, "news_feeds", &(config->news_feeds));
+                }
                 else if (streq (key, "ManualChecks")
                         || streq (key, "AutoChecks"))
                 {
@@ -1166,6 +1173,111 @@ parse_config_file (const char       *file,
                         continue;
                     }
                 }
+                else if (streq (key, "AurParallel"))
+                {
+                    config->aur_parallel = atoi (value);
+                    if (config->aur_parallel < 1)
+                    {
+                        add_error ("invalid value for %s: %s", key, value);
+                        config->aur_parallel = DEFAULT_AUR_PARALLEL;
+                        continue;
+                    }
+                    debug ("config: AUR parallel requests: %d",
+                            config->aur_parallel);
+                }
+                else if (streq (key, "AurCacheTTL"))
+                {
+                    char *e;
+                    long l;
+
+                    l = strtol (value, &e, 10);
+                    if (*value == '\0' || *e != '\0' || l < 0 || l > G_MAXINT / 60)
+                    {
+                        add_error ("invalid value for %s: %s", key, value);
+                        continue;
+                    }
+                    config->aur_cache_ttl = (int) l * 60; /* minutes into seconds */
+                    debug ("config: AUR cache TTL: %d", config->aur_cache_ttl);
+                }
+                else if (streq (key, "AurBackend"))
+                {
+                    if (streq (value, "auto"))
+                    {
+                        config->aur_backend = AUR_BACKEND_AUTO;
+                    }
+                    else if (streq (value, "rpc"))
+                    {
+                        config->aur_backend = AUR_BACKEND_RPC;
+                    }
+                    else if (streq (value, "archive"))
+                    {
+                        config->aur_backend = AUR_BACKEND_ARCHIVE;
+                    }
+                    else
+                    {
+                        add_error ("unknown value for %s: %s", key, value);
+                        continue;
+                    }
+                    debug ("config: AUR backend: %s", value);
+                }
+                else if (streq (key, "AurArchiveThreshold"))
+                {
+                    config->aur_archive_threshold = atoi (value);
+                    if (config->aur_archive_threshold < 1)
+                    {
+                        add_error ("invalid value for %s: %s", key, value);
+                        config->aur_archive_threshold = DEFAULT_AUR_ARCHIVE_THRESHOLD;
+                        continue;
+                    }
+                    debug ("config: AUR archive threshold: %d",
+                            config->aur_archive_threshold);
+                }
+                else if (streq (key, "ConnectTimeout")
+                        || streq (key, "StallTimeout")
+                        || streq (key, "DownloadTimeout")
+                        || streq (key, "DownloadRetries"))
+                {
+                    char *e;
+                    long l;
+                    int *cfg;
+
+                    l = strtol (value, &e, 10);
+                    if (*value == '\0' || *e != '\0' || l < 0 || l > G_MAXINT)
+                    {
+                        add_error ("invalid value for %s: %s", key, value);
+                        continue;
+                    }
+
+                    if (streq (key, "ConnectTimeout"))
+                        cfg = &config->connect_timeout;
+                    else if (streq (key, "StallTimeout"))
+                        cfg = &config->stall_timeout;
+                    else if (streq (key, "DownloadTimeout"))
+                        cfg = &config->download_timeout;
+                    else
+                        cfg = &config->download_retries;
+
+                    *cfg = (int) l;
+                    debug ("config: set %s to %d", key, *cfg);
+                }
+                else if (streq (key, "SyncDbsParallel"))
+                {
+                    config->syncdbs_parallel = atoi (value);
+                    if (config->syncdbs_parallel < 1)
+                    {
+                        add_error ("invalid value for %s: %s", key, value);
+                        config->syncdbs_parallel = DEFAULT_SYNCDBS_PARALLEL;
+                        continue;
+                    }
+                    debug ("config: sync DBs parallel downloads: %d",
+                            config->syncdbs_parallel);
+                }
+                else if (streq (key, "FullAutoChecks"))
+                {
+                    config->full_auto_checks = (*value == '1');
+                    debug ("config: full auto-checks: %d",
+                            config->full_auto_checks);
+                }
                 else if (streq (key, "AutoNotifs"))
                 {
                     if (value[0] == '0' && value[1] == '\0')
@@ -1362,23 +1474,28 @@ parse_config_file (const char       *file,
                         w_pkg->name, w_pkg->version);
             }
         }
-        /* news.conf */
+        /* news.conf: sections are feed URLs, none meaning the Arch feed */
         else if (conf_file == CONF_FILE_NEWS)
         {
+            news_state_t *state;
+
             if (value == NULL)
             {
                 add_error ("news data: value missing for %s", key);
                 continue;
             }
-            else if (streq ("Last", key))
+
+            state = news_add_state (&config->news_states,
+                    (section) ? section : NEWS_RSS_URL);
+            if (streq ("Last", key))
             {
-                config->news_last = strdup (value);
+                free (state->last);
+                state->last = strdup (value);
                 debug ("config: news_last: %s", value);
             }
             else if (streq ("Read", key))
             {
-                config->news_read = alpm_list_add (config->news_read,
-                        strdup (value));
+                g_hash_table_add (state->read, strdup (value));
                 debug ("config: news_read: added %s", value);
             }
         }
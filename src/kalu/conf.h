@@ -68,6 +68,7 @@ typedef struct _pacman_config_t {
     /* non-alpm */
     alpm_list_t     *syncfirst;
     unsigned short   verbosepkglists;
+    alpm_list_t     *files;     /* parsed, i.e. pacman.conf & its Includes */
     
     /* dbs/repos */
     alpm_list_t     *databases;
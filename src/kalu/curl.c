@@ -24,6 +24,8 @@
 
 /* C */
 #include <string.h>
+#include <strings.h> /* strncasecmp() */
+#include <unistd.h>  /* access(), unlink() */
 
 /* curl */
 #include <curl/curl.h>
@@ -31,6 +33,7 @@
 /* kalu */
 #include "kalu.h"
 #include "curl.h"
+#include "util.h"
 
 /* struct to hold data downloaded via curl */
 typedef struct _string_t {
@@ -39,15 +42,292 @@ typedef struct _string_t {
     size_t  alloc;
 } string_t;
 
+/* how many transfers are kept in the metrics table */
+#define NB_METRICS      64
+
+/* process-wide download context: easy handles are put back into the pool once
+ * done, so the next download re-uses them (and their keep-alive connections),
+ * and all of them share the DNS cache, TLS sessions & connection cache */
+static struct {
+    CURLSH      *share;
+    GMutex       share_locks[CURL_LOCK_DATA_LAST];
+    GMutex       lock;
+    GPtrArray   *handles;
+    curl_stats_t stats;
+    /* metrics of the last NB_METRICS transfers, as a ring buffer */
+    curl_metrics_t metrics[NB_METRICS];
+    guint        next_metrics;
+    guint        nb_metrics;
+} pool;
+
+static void
+share_lock (CURL *curl _UNUSED_, curl_lock_data data,
+            curl_lock_access access _UNUSED_, void *userptr _UNUSED_)
+{
+    g_mutex_lock (&pool.share_locks[data]);
+}
+
+static void
+share_unlock (CURL *curl _UNUSED_, curl_lock_data data, void *userptr _UNUSED_)
+{
+    g_mutex_unlock (&pool.share_locks[data]);
+}
+
+gboolean
+curl_pool_init (void)
+{
+    pool.share = curl_share_init ();
+    if (!pool.share)
+    {
+        return FALSE;
+    }
+    pool.handles = g_ptr_array_new ();
+
+    curl_share_setopt (pool.share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt (pool.share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt (pool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt (pool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    /* sharing the connection cache requires cURL 7.57.0 */
+    curl_share_setopt (pool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+
+    return TRUE;
+}
+
+void
+curl_pool_cleanup (void)
+{
+    guint i;
+
+    for (i = 0; i < NB_METRICS; ++i)
+    {
+        free (pool.metrics[i].url);
+    }
+
+    if (pool.handles)
+    {
+        for (i = 0; i < pool.handles->len; ++i)
+        {
+            curl_easy_cleanup (pool.handles->pdata[i]);
+        }
+        g_ptr_array_free (pool.handles, TRUE);
+        pool.handles = NULL;
+    }
+    if (pool.share)
+    {
+        curl_share_cleanup (pool.share);
+        pool.share = NULL;
+    }
+}
+
+void
+curl_pool_get_stats (curl_stats_t *stats)
+{
+    g_mutex_lock (&pool.lock);
+    memcpy (stats, &pool.stats, sizeof (curl_stats_t));
+    g_mutex_unlock (&pool.lock);
+}
+
+/* returns a copy of the metrics table, oldest transfer first. To be freed using
+ * curl_pool_free_metrics() */
+curl_metrics_t *
+curl_pool_get_metrics (guint *nb)
+{
+    curl_metrics_t *metrics;
+    guint i, j;
+
+    g_mutex_lock (&pool.lock);
+    *nb = pool.nb_metrics;
+    metrics = new (curl_metrics_t, MAX (1, *nb));
+    j = (pool.next_metrics + NB_METRICS - pool.nb_metrics) % NB_METRICS;
+    for (i = 0; i < pool.nb_metrics; ++i, j = (j + 1) % NB_METRICS)
+    {
+        memcpy (&metrics[i], &pool.metrics[j], sizeof (curl_metrics_t));
+        metrics[i].url = strdup (pool.metrics[j].url);
+    }
+    g_mutex_unlock (&pool.lock);
+
+    return metrics;
+}
+
+void
+curl_pool_free_metrics (curl_metrics_t *metrics, guint nb)
+{
+    guint i;
+
+    for (i = 0; i < nb; ++i)
+    {
+        free (metrics[i].url);
+    }
+    free (metrics);
+}
+
+#if LIBCURL_VERSION_NUM >= 0x073d00
+/* timings as curl_off_t in microseconds require cURL 7.61.0 */
+#define get_time(curl, info, t)   do {        \
+    curl_off_t _t = 0;                        \
+    curl_easy_getinfo (curl, info##_T, &_t);  \
+    t = (guint64) _t;                         \
+} while (0)
+#define get_size(curl, info, s)   do {        \
+    curl_off_t _s = 0;                        \
+    curl_easy_getinfo (curl, info##_T, &_s);  \
+    s = (guint64) _s;                         \
+} while (0)
+#else
+#define get_time(curl, info, t)   do {    \
+    double _t = 0;                        \
+    curl_easy_getinfo (curl, info, &_t);  \
+    t = (guint64) (_t * G_USEC_PER_SEC);  \
+} while (0)
+#define get_size(curl, info, s)   do {    \
+    double _s = 0;                        \
+    curl_easy_getinfo (curl, info, &_s);  \
+    s = (guint64) _s;                     \
+} while (0)
+#endif
+
+static void
+get_metrics (CURL *curl, gboolean is_success, long nb_connects,
+             curl_metrics_t *m)
+{
+    char *url = NULL;
+
+    curl_easy_getinfo (curl, CURLINFO_EFFECTIVE_URL, &url);
+    m->url = strdup ((url) ? url : "");
+    m->is_success = is_success;
+    m->is_reused = (nb_connects == 0);
+    get_time (curl, CURLINFO_NAMELOOKUP_TIME, m->namelookup);
+    get_time (curl, CURLINFO_CONNECT_TIME, m->connect);
+    get_time (curl, CURLINFO_APPCONNECT_TIME, m->appconnect);
+    get_time (curl, CURLINFO_STARTTRANSFER_TIME, m->starttransfer);
+    get_time (curl, CURLINFO_TOTAL_TIME, m->total);
+    get_size (curl, CURLINFO_SIZE_DOWNLOAD, m->bytes);
+
+    debug ("%s: namelookup %.3fs, connect %.3fs, appconnect %.3fs, "
+            "starttransfer %.3fs, total %.3fs; %" G_GUINT64_FORMAT " bytes%s",
+            m->url,
+            (double) m->namelookup / G_USEC_PER_SEC,
+            (double) m->connect / G_USEC_PER_SEC,
+            (double) m->appconnect / G_USEC_PER_SEC,
+            (double) m->starttransfer / G_USEC_PER_SEC,
+            (double) m->total / G_USEC_PER_SEC,
+            m->bytes,
+            (m->is_reused) ? ", connection re-used" : "");
+}
+#undef get_size
+#undef get_time
+
+static CURL *
+get_handle (void)
+{
+    CURL *curl = NULL;
+
+    g_mutex_lock (&pool.lock);
+    if (pool.handles && pool.handles->len > 0)
+    {
+        curl = g_ptr_array_remove_index_fast (pool.handles,
+                pool.handles->len - 1);
+    }
+    g_mutex_unlock (&pool.lock);
+
+    if (!curl)
+    {
+        curl = curl_easy_init ();
+        if (!curl)
+        {
+            return NULL;
+        }
+    }
+
+    curl_easy_setopt (curl, CURLOPT_USERAGENT, PACKAGE_NAME "/" PACKAGE_VERSION);
+    curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 1);
+    /* empty string: all encodings supported (gzip, brotli, ...) */
+    curl_easy_setopt (curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt (curl, CURLOPT_CONNECTTIMEOUT, (long) config->connect_timeout);
+    if (config->stall_timeout > 0)
+    {
+        /* abort if less than 1 byte/s over that many seconds */
+        curl_easy_setopt (curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt (curl, CURLOPT_LOW_SPEED_TIME, (long) config->stall_timeout);
+    }
+    curl_easy_setopt (curl, CURLOPT_TIMEOUT, (long) config->download_timeout);
+    if (pool.share)
+    {
+        curl_easy_setopt (curl, CURLOPT_SHARE, pool.share);
+    }
+    if (config->use_ip == IPv4)
+    {
+        debug ("set curl to IPv4");
+        curl_easy_setopt (curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4);
+    }
+    else if (config->use_ip == IPv6)
+    {
+        debug ("set curl to IPv6");
+        curl_easy_setopt (curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V6);
+    }
+
+    return curl;
+}
+
+static void
+release_handle (CURL *curl, gboolean is_success)
+{
+    curl_metrics_t metrics;
+    long nb_connects = 0;
+
+    curl_easy_getinfo (curl, CURLINFO_NUM_CONNECTS, &nb_connects);
+    get_metrics (curl, is_success, nb_connects, &metrics);
+
+    g_mutex_lock (&pool.lock);
+    free (pool.metrics[pool.next_metrics].url);
+    memcpy (&pool.metrics[pool.next_metrics], &metrics, sizeof (curl_metrics_t));
+    pool.next_metrics = (pool.next_metrics + 1) % NB_METRICS;
+    if (pool.nb_metrics < NB_METRICS)
+    {
+        ++pool.nb_metrics;
+    }
+
+    if (is_success)
+    {
+        ++pool.stats.nb_transfers;
+        if (nb_connects == 0)
+        {
+            ++pool.stats.nb_reused;
+        }
+        else
+        {
+            pool.stats.nb_connects += (guint) nb_connects;
+        }
+    }
+
+    if (pool.handles)
+    {
+        /* reset options (e.g. our buffers) but keep caches & connections */
+        curl_easy_reset (curl);
+        g_ptr_array_add (pool.handles, curl);
+        curl = NULL;
+    }
+    g_mutex_unlock (&pool.lock);
+
+    if (curl)
+    {
+        curl_easy_cleanup (curl);
+    }
+}
+
 static size_t
 curl_write (void *content, size_t size, size_t nmemb, string_t *data)
 {
     size_t total = size * nmemb;
 
-    /* alloc memory if needed */
+    /* alloc memory if needed; grows geometrically, so large downloads coming
+     * in lots of small chunks don't end up in as many reallocs */
     if (data->len + total >= data->alloc)
     {
-        data->alloc += total + 1024;
+        data->alloc = MAX (2 * data->alloc, data->len + total + 1024);
         data->content = renew (char, data->alloc, data->content);
     }
 
@@ -58,6 +338,165 @@ curl_write (void *content, size_t size, size_t nmemb, string_t *data)
     return total;
 }
 
+/* validators of a cached download, as sent back by the server */
+typedef struct _validators_t {
+    char *etag;
+    char *last_modified;
+} validators_t;
+
+/* to stream a download to a sink */
+typedef struct _sink_t {
+    curl_sink_fn         fn;
+    gpointer             data;
+    string_t            *tee;   /* if not NULL, content also gets stored there */
+    GError              *error;
+    size_t               len;   /* how much was given to fn */
+    /* fn doesn't want any more data, the transfer was then aborted. Whatever
+     * was received is incomplete, so it mustn't be cached */
+    gboolean             is_done;
+} sink_t;
+
+static size_t
+curl_write_sink (void *content, size_t size, size_t nmemb, sink_t *sink)
+{
+    size_t total = size * nmemb;
+
+    if (sink->tee)
+    {
+        curl_write (content, size, nmemb, sink->tee);
+    }
+    /* returning anything but total makes cURL abort the transfer */
+    if (!sink->fn (content, total, sink->data, &sink->error))
+    {
+        /* no error: the sink simply doesn't need the rest */
+        if (!sink->error)
+        {
+            sink->is_done = TRUE;
+        }
+        return 0;
+    }
+    sink->len += total;
+
+    return total;
+}
+
+static void
+setup_sink (CURL *curl, sink_t *sink)
+{
+    curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, (curl_write_callback) curl_write_sink);
+    curl_easy_setopt (curl, CURLOPT_WRITEDATA, (void *) sink);
+}
+
+static void
+setup_download (CURL *curl, const char *url, string_t *data, char *errmsg)
+{
+    curl_easy_setopt (curl, CURLOPT_URL, url);
+    if (data)
+    {
+        curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, (curl_write_callback) curl_write);
+        curl_easy_setopt (curl, CURLOPT_WRITEDATA, (void *) data);
+    }
+    curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, errmsg);
+    errmsg[0] = '\0';
+}
+
+/* whether a failure is worth trying again: network issues & timeouts, as well
+ * as server-side errors (HTTP 5xx) and rate limiting (HTTP 429) */
+static gboolean
+is_transient (CURLcode res, long code)
+{
+    switch (res)
+    {
+        case CURLE_OK:
+        case CURLE_HTTP_RETURNED_ERROR: /* when using CURLOPT_FAILONERROR */
+            return code == 429 || (code >= 500 && code <= 599);
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_SSL_CONNECT_ERROR:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/* exponential backoff with jitter: attempt n waits a random delay between
+ * half & all of 2^n seconds, so clients failing together don't all retry at
+ * the same time; In microseconds */
+static gulong
+get_retry_delay (guint attempt)
+{
+    gulong max = G_USEC_PER_SEC << MIN (attempt, 6);
+
+    return max / 2 + (gulong) g_random_int_range (0, (gint32) (max / 2));
+}
+
+/* performs the transfer, retrying on transient failures as long as nothing was
+ * given out to a sink (since we can't take that back) */
+static CURLcode
+perform (CURL *curl, const char *url, string_t *data, sink_t *sink)
+{
+    CURLcode res;
+    guint attempt = 0;
+
+    for (;;)
+    {
+        long code = 0;
+        gulong delay;
+
+        res = curl_easy_perform (curl);
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &code);
+        if (res == CURLE_WRITE_ERROR && sink && sink->is_done)
+        {
+            debug ("downloading %s stopped early, the rest isn't needed", url);
+            res = CURLE_OK;
+        }
+
+        if (attempt >= (guint) config->download_retries
+                || !is_transient (res, code)
+                || (sink && sink->len > 0))
+        {
+            return res;
+        }
+
+        delay = get_retry_delay (attempt++);
+        if (res == CURLE_OK)
+        {
+            debug ("downloading %s failed (HTTP %ld), retrying in %lums",
+                    url, code, delay / 1000);
+        }
+        else
+        {
+            debug ("downloading %s failed (%s), retrying in %lums",
+                    url, curl_easy_strerror (res), delay / 1000);
+        }
+        g_usleep (delay);
+
+        /* drop anything we might have gotten */
+        if (data)
+        {
+            data->len = 0;
+        }
+    }
+}
+
+static char *
+finish_download (string_t *data)
+{
+    debug ("downloaded %d bytes", data->len);
+    if (!data->content)
+    {
+        data->content = new (char, 1);
+    }
+    /* content is not NULL-terminated yet */
+    data->content[data->len] = '\0';
+    return data->content;
+}
+
 char *
 curl_download (const char *url, GError **error)
 {
@@ -68,46 +507,812 @@ curl_download (const char *url, GError **error)
     debug ("downloading %s", url);
     zero (data);
 
-    curl = curl_easy_init();
+    curl = get_handle ();
     if (!curl)
     {
         g_set_error (error, KALU_ERROR, 1, _("Unable to init cURL\n"));
         return NULL;
     }
 
-    curl_easy_setopt (curl, CURLOPT_USERAGENT, PACKAGE_NAME "/" PACKAGE_VERSION);
-    curl_easy_setopt (curl, CURLOPT_URL, url);
-    curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1);
-    curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 1);
-    curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, (curl_write_callback) curl_write);
-    curl_easy_setopt (curl, CURLOPT_WRITEDATA, (void *) &data);
-    curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, errmsg);
-    if (config->use_ip == IPv4)
+    setup_download (curl, url, &data, errmsg);
+
+    if (perform (curl, url, &data, NULL) != CURLE_OK)
     {
-        debug ("set curl to IPv4");
-        curl_easy_setopt (curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4);
+        release_handle (curl, FALSE);
+        if (data.content != NULL)
+        {
+            free (data.content);
+        }
+        g_set_error (error, KALU_ERROR, 1, "%s", errmsg);
+        return NULL;
     }
-    else if (config->use_ip == IPv6)
+    release_handle (curl, TRUE);
+
+    return finish_download (&data);
+}
+
+/* downloads url, giving the content to sink chunk by chunk as it arrives,
+ * without keeping it in memory. If sink fails, the transfer is aborted and its
+ * error returned */
+gboolean
+curl_download_sink (const char     *url,
+                    curl_sink_fn    sink_fn,
+                    gpointer        sink_data,
+                    GError        **error)
+{
+    CURL *curl;
+    CURLcode res;
+    sink_t sink = { sink_fn, sink_data, NULL, NULL, 0, FALSE };
+    char errmsg[CURL_ERROR_SIZE];
+
+    debug ("downloading %s", url);
+
+    curl = get_handle ();
+    if (!curl)
     {
-        debug ("set curl to IPv6");
-        curl_easy_setopt (curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V6);
+        g_set_error (error, KALU_ERROR, 1, _("Unable to init cURL\n"));
+        return FALSE;
     }
 
-    if (curl_easy_perform (curl) != 0)
+    setup_download (curl, url, NULL, errmsg);
+    setup_sink (curl, &sink);
+
+    res = perform (curl, url, NULL, &sink);
+    release_handle (curl, res == CURLE_OK);
+    if (res != CURLE_OK)
     {
-        curl_easy_cleanup (curl);
-        if (data.content != NULL)
+        if (sink.error)
         {
-            free (data.content);
+            g_propagate_error (error, sink.error);
         }
-        g_set_error (error, KALU_ERROR, 1, "%s", errmsg);
+        else
+        {
+            g_set_error (error, KALU_ERROR, 1, "%s", errmsg);
+        }
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static size_t
+curl_header (char *buffer, size_t size, size_t nitems, validators_t *validators)
+{
+    size_t total = size * nitems;
+    char **v = NULL;
+    size_t l;
+
+    /* new response (e.g. after a redirect): forget previous headers */
+    if (total > 5 && streqn (buffer, "HTTP/", 5))
+    {
+        free (validators->etag);
+        free (validators->last_modified);
+        validators->etag = validators->last_modified = NULL;
+        return total;
+    }
+
+    if (total > 5 && strncasecmp (buffer, "ETag:", 5) == 0)
+    {
+        v = &validators->etag;
+        l = 5;
+    }
+    else if (total > 14 && strncasecmp (buffer, "Last-Modified:", 14) == 0)
+    {
+        v = &validators->last_modified;
+        l = 14;
+    }
+
+    if (v)
+    {
+        free (*v);
+        *v = strtrim (strndup (buffer + l, total - l));
+        if (**v == '\0')
+        {
+            free (*v);
+            *v = NULL;
+        }
+    }
+
+    return total;
+}
+
+static void
+get_cache_files (const char *cache_name, char *file, char *file_validators)
+{
+    snprintf (file, PATH_MAX, "%s/kalu/%s", g_get_user_cache_dir (), cache_name);
+    snprintf (file_validators, PATH_MAX, "%s.validators", file);
+}
+
+static void
+load_validators (const char *file, validators_t *validators)
+{
+    gchar *data, *s, *e;
+
+    if (!g_file_get_contents (file, &data, NULL, NULL))
+    {
+        return;
+    }
+
+    for (s = data; *s; s = e)
+    {
+        e = strchr (s, '\n');
+        if (e)
+        {
+            *e++ = '\0';
+        }
+        else
+        {
+            e = s + strlen (s);
+        }
+
+        if (streqn (s, "ETag=", 5))
+        {
+            validators->etag = strdup (s + 5);
+        }
+        else if (streqn (s, "Last-Modified=", 14))
+        {
+            validators->last_modified = strdup (s + 14);
+        }
+    }
+    g_free (data);
+}
+
+/* headers for a conditional request, from the validators saved in file */
+static struct curl_slist *
+get_conditional_headers (const char *file_validators)
+{
+    struct curl_slist *headers = NULL;
+    validators_t validators;
+
+    zero (validators);
+    load_validators (file_validators, &validators);
+    if (validators.etag)
+    {
+        char buf[1024];
+
+        snprintf (buf, 1024, "If-None-Match: %s", validators.etag);
+        headers = curl_slist_append (headers, buf);
+    }
+    if (validators.last_modified)
+    {
+        char buf[1024];
+
+        snprintf (buf, 1024, "If-Modified-Since: %s", validators.last_modified);
+        headers = curl_slist_append (headers, buf);
+    }
+    free (validators.etag);
+    free (validators.last_modified);
+
+    return headers;
+}
+
+static void
+save_validators (const char *file_validators, validators_t *validators)
+{
+    GString *str;
+
+    str = g_string_sized_new (255);
+    if (validators->etag)
+    {
+        g_string_append_printf (str, "ETag=%s\n", validators->etag);
+    }
+    if (validators->last_modified)
+    {
+        g_string_append_printf (str, "Last-Modified=%s\n",
+                validators->last_modified);
+    }
+    if (!g_file_set_contents (file_validators, str->str, (gssize) str->len, NULL))
+    {
+        debug ("unable to save cache validators %s", file_validators);
+    }
+    g_string_free (str, TRUE);
+}
+
+static void
+save_cache (const char *file, const char *file_validators,
+            string_t *data, validators_t *validators)
+{
+    char path[PATH_MAX];
+
+    snprintf (path, PATH_MAX, "%s", file);
+    if (!ensure_path (path))
+    {
+        debug ("unable to create cache folder for %s", file);
+        return;
+    }
+
+    /* no validators means we'll never get a 304, so no need to cache */
+    if (!validators->etag && !validators->last_modified)
+    {
+        unlink (file_validators);
+        unlink (file);
+        return;
+    }
+
+    /* remove validators first, so a failure saving the content can't leave us
+     * with validators & an outdated content */
+    unlink (file_validators);
+    if (!g_file_set_contents (file, data->content, (gssize) data->len, NULL))
+    {
+        debug ("unable to save cache %s", file);
+        return;
+    }
+
+    save_validators (file_validators, validators);
+}
+
+/* conditional download: content & validators (ETag/Last-Modified) are stored
+ * in cache_name (in our cache folder), and used on the next download. If the
+ * server then replies 304 Not Modified, the cached content is returned and
+ * is_modified set to FALSE.
+ * If sink_fn is specified, content being downloaded is also streamed to it (not
+ * when coming from cache, since then nothing is downloaded). Should it be done
+ * early, the transfer is stopped and the content returned is only what was
+ * received. The cache is then left as is, old content & validators: it'll be
+ * downloaded again next time (unless it's still what was cached), but that's
+ * the point of stopping early, e.g. for news only the first items are needed */
+char *
+curl_download_cached (const char   *url,
+                      const char   *cache_name,
+                      curl_sink_fn  sink_fn,
+                      gpointer      sink_data,
+                      gboolean     *is_modified,
+                      GError      **error)
+{
+    CURL *curl;
+    CURLcode res;
+    string_t data;
+    sink_t sink = { sink_fn, sink_data, NULL, NULL, 0, FALSE };
+    validators_t validators;
+    struct curl_slist *headers = NULL;
+    char errmsg[CURL_ERROR_SIZE];
+    char file[PATH_MAX], file_validators[PATH_MAX];
+    long code = 0;
+
+    get_cache_files (cache_name, file, file_validators);
+    *is_modified = TRUE;
+
+    debug ("downloading %s (cache: %s)", url, cache_name);
+    zero (data);
+    zero (validators);
+
+    curl = get_handle ();
+    if (!curl)
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to init cURL\n"));
         return NULL;
     }
-    curl_easy_cleanup (curl);
-    debug ("downloaded %d bytes", data.len);
 
-    /* content is not NULL-terminated yet */
-    data.content[data.len] = '\0';
+    setup_download (curl, url, &data, errmsg);
+    if (sink_fn)
+    {
+        sink.tee = &data;
+        setup_sink (curl, &sink);
+    }
+
+    /* only do a conditional request if we have the content */
+    if (access (file, R_OK) == 0)
+    {
+        headers = get_conditional_headers (file_validators);
+        curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
+    }
+    curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, (curl_write_callback) curl_header);
+    curl_easy_setopt (curl, CURLOPT_HEADERDATA, (void *) &validators);
+
+    res = perform (curl, url, &data, (sink_fn) ? &sink : NULL);
+    if (res == CURLE_OK)
+    {
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &code);
+    }
+    release_handle (curl, res == CURLE_OK);
+    curl_slist_free_all (headers);
+
+    if (res != CURLE_OK)
+    {
+        free (data.content);
+        free (validators.etag);
+        free (validators.last_modified);
+        if (sink.error)
+        {
+            g_propagate_error (error, sink.error);
+        }
+        else
+        {
+            g_set_error (error, KALU_ERROR, 1, "%s", errmsg);
+        }
+        return NULL;
+    }
+
+    if (code == 304)
+    {
+        gchar *content;
+
+        free (data.content);
+        free (validators.etag);
+        free (validators.last_modified);
+
+        if (g_file_get_contents (file, &content, NULL, NULL))
+        {
+            debug ("not modified, using cache %s", file);
+            *is_modified = FALSE;
+            return content;
+        }
+
+        /* cache vanished in the meantime, just download it again */
+        unlink (file_validators);
+        return curl_download_cached (url, cache_name, sink_fn, sink_data,
+                is_modified, error);
+    }
+
+    finish_download (&data);
+    if (code == 200 && !sink.is_done)
+    {
+        save_cache (file, file_validators, &data, &validators);
+    }
+    free (validators.etag);
+    free (validators.last_modified);
 
     return data.content;
 }
+
+/* like curl_download_cached() except the content itself isn't kept, only
+ * streamed to sink_fn, so the caller can store whatever it makes of it as
+ * cache_name (in our cache folder). Only validators are saved here, and a
+ * conditional request is done only if cache_name exists.
+ * On 304 Not Modified, is_modified is set to FALSE and nothing was streamed. */
+gboolean
+curl_download_revalidate (const char   *url,
+                          const char   *cache_name,
+                          curl_sink_fn  sink_fn,
+                          gpointer      sink_data,
+                          gboolean     *is_modified,
+                          GError      **error)
+{
+    CURL *curl;
+    CURLcode res;
+    sink_t sink = { sink_fn, sink_data, NULL, NULL, 0, FALSE };
+    validators_t validators;
+    struct curl_slist *headers = NULL;
+    char errmsg[CURL_ERROR_SIZE];
+    char file[PATH_MAX], file_validators[PATH_MAX];
+    long code = 0;
+
+    get_cache_files (cache_name, file, file_validators);
+    *is_modified = TRUE;
+
+    debug ("downloading %s (revalidating: %s)", url, cache_name);
+    zero (validators);
+
+    curl = get_handle ();
+    if (!curl)
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to init cURL\n"));
+        return FALSE;
+    }
+
+    setup_download (curl, url, NULL, errmsg);
+    setup_sink (curl, &sink);
+    /* don't stream error pages to the sink */
+    curl_easy_setopt (curl, CURLOPT_FAILONERROR, 1L);
+
+    if (access (file, R_OK) == 0)
+    {
+        headers = get_conditional_headers (file_validators);
+        curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
+    }
+    curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, (curl_write_callback) curl_header);
+    curl_easy_setopt (curl, CURLOPT_HEADERDATA, (void *) &validators);
+
+    res = perform (curl, url, NULL, &sink);
+    if (res == CURLE_OK)
+    {
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &code);
+    }
+    release_handle (curl, res == CURLE_OK);
+    curl_slist_free_all (headers);
+
+    if (res != CURLE_OK)
+    {
+        free (validators.etag);
+        free (validators.last_modified);
+        if (sink.error)
+        {
+            g_propagate_error (error, sink.error);
+        }
+        else
+        {
+            g_set_error (error, KALU_ERROR, 1, "%s", errmsg);
+        }
+        return FALSE;
+    }
+
+    if (code == 304)
+    {
+        debug ("not modified: %s", url);
+        *is_modified = FALSE;
+    }
+    else if (sink.is_done)
+    {
+        /* what was cached by the caller is left as is, as are validators */
+        debug ("downloaded %lu bytes, stopped early", (unsigned long) sink.len);
+    }
+    else
+    {
+        debug ("downloaded %lu bytes", (unsigned long) sink.len);
+        /* without validators there's no way to get a 304 */
+        unlink (file_validators);
+        if ((validators.etag || validators.last_modified)
+                && ensure_path (file))
+        {
+            save_validators (file_validators, &validators);
+        }
+    }
+    free (validators.etag);
+    free (validators.last_modified);
+
+    return TRUE;
+}
+
+/* a download in progress as part of curl_download_multi() */
+typedef struct _transfer_t {
+    CURL            *curl;
+    curl_request_t  *request;
+    const char      *url;
+    string_t         data;
+    sink_t           sink;
+    char             errmsg[CURL_ERROR_SIZE];
+    guint            attempt;
+    gint64           retry_at;  /* when waiting to be retried (monotonic time) */
+    /* for a cached download */
+    validators_t         validators;
+    struct curl_slist   *headers;
+    char                 file[PATH_MAX];
+    char                 file_validators[PATH_MAX];
+} transfer_t;
+
+static void
+free_transfer (transfer_t *transfer, gboolean is_success)
+{
+    release_handle (transfer->curl, is_success);
+    free (transfer->data.content);
+    g_clear_error (&transfer->sink.error);
+    curl_slist_free_all (transfer->headers);
+    free (transfer->validators.etag);
+    free (transfer->validators.last_modified);
+    free (transfer);
+}
+
+/* sets up a conditional download, as curl_download_cached() does */
+static void
+setup_cached (transfer_t *transfer, const char *cache_name)
+{
+    get_cache_files (cache_name, transfer->file, transfer->file_validators);
+    if (access (transfer->file, R_OK) == 0)
+    {
+        transfer->headers = get_conditional_headers (transfer->file_validators);
+        curl_easy_setopt (transfer->curl, CURLOPT_HTTPHEADER, transfer->headers);
+    }
+    curl_easy_setopt (transfer->curl, CURLOPT_HEADERFUNCTION,
+            (curl_write_callback) curl_header);
+    curl_easy_setopt (transfer->curl, CURLOPT_HEADERDATA,
+            (void *) &transfer->validators);
+}
+
+static int
+ptr_cmp (const void *p1, const void *p2)
+{
+    return p1 != p2;
+}
+
+/* downloads all requests, with up to max_parallel transfers going on at once;
+ * Each time one completes, callback is called with its content (which will be
+ * freed afterwards), so it can be processed while the others are still going.
+ * Requests with a sink_fn get their content streamed to it as it arrives
+ * instead, and the callback then gets NULL.
+ * Requests with a cache_name are conditional downloads, like with
+ * curl_download_cached(): when not modified, the callback gets the cached
+ * content (even with a sink_fn).
+ * Stops everything on the first failure, be it of a download (unless it may
+ * fail) or the callback */
+gboolean
+curl_download_multi (alpm_list_t *requests, guint max_parallel,
+                     curl_multi_cb callback, gpointer cb_data,
+                     GError **error)
+{
+    GError *local_err = NULL;
+    CURLM *multi;
+    CURLMsg *msg;
+    alpm_list_t *next = requests;
+    alpm_list_t *transfers = NULL, *i;
+    CURLMcode mc;
+    int running = 0, left;
+    gint64 now, next_retry;
+
+    if (max_parallel < 1)
+    {
+        max_parallel = 1;
+    }
+
+    multi = curl_multi_init ();
+    if (!multi)
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to init cURL\n"));
+        return FALSE;
+    }
+
+    for (;;)
+    {
+        /* start new transfers, if we can */
+        while (next && alpm_list_count (transfers) < max_parallel)
+        {
+            curl_request_t *request = next->data;
+            transfer_t *transfer;
+
+            transfer = new0 (transfer_t, 1);
+            transfer->request = request;
+            transfer->url = request->url;
+            transfer->curl = get_handle ();
+            if (!transfer->curl)
+            {
+                free (transfer);
+                g_set_error (&local_err, KALU_ERROR, 1, _("Unable to init cURL\n"));
+                goto done;
+            }
+            debug ("downloading %s", transfer->url);
+            if (request->sink_fn)
+            {
+                setup_download (transfer->curl, transfer->url, NULL,
+                        transfer->errmsg);
+                transfer->sink.fn = request->sink_fn;
+                transfer->sink.data = request->sink_data;
+                if (request->cache_name)
+                {
+                    /* content is also needed, to be cached */
+                    transfer->sink.tee = &transfer->data;
+                }
+                setup_sink (transfer->curl, &transfer->sink);
+                /* don't stream error pages to the sink */
+                curl_easy_setopt (transfer->curl, CURLOPT_FAILONERROR, 1L);
+            }
+            else
+            {
+                setup_download (transfer->curl, transfer->url, &transfer->data,
+                        transfer->errmsg);
+            }
+            if (request->post)
+            {
+                debug ("POST data: %zu bytes", strlen (request->post));
+                curl_easy_setopt (transfer->curl, CURLOPT_POSTFIELDS, request->post);
+            }
+            if (request->cache_name)
+            {
+                debug ("cache: %s", request->cache_name);
+                setup_cached (transfer, request->cache_name);
+            }
+            else if (request->if_modified_since > 0)
+            {
+                curl_easy_setopt (transfer->curl, CURLOPT_TIMECONDITION,
+                        (long) CURL_TIMECOND_IFMODSINCE);
+                curl_easy_setopt (transfer->curl, CURLOPT_TIMEVALUE,
+                        (long) request->if_modified_since);
+            }
+            curl_easy_setopt (transfer->curl, CURLOPT_FILETIME, 1L);
+            curl_easy_setopt (transfer->curl, CURLOPT_PRIVATE, transfer);
+            curl_multi_add_handle (multi, transfer->curl);
+            transfers = alpm_list_add (transfers, transfer);
+            next = next->next;
+        }
+
+        if (!transfers)
+        {
+            break;
+        }
+
+        /* (re)start transfers that were waiting to be retried */
+        now = g_get_monotonic_time ();
+        next_retry = 0;
+        FOR_LIST (i, transfers)
+        {
+            transfer_t *transfer = i->data;
+
+            if (transfer->retry_at == 0)
+            {
+                continue;
+            }
+            if (transfer->retry_at <= now)
+            {
+                debug ("downloading %s (attempt %u)", transfer->url,
+                        transfer->attempt + 1);
+                transfer->retry_at = 0;
+                curl_multi_add_handle (multi, transfer->curl);
+            }
+            else if (next_retry == 0 || transfer->retry_at < next_retry)
+            {
+                next_retry = transfer->retry_at;
+            }
+        }
+
+        mc = curl_multi_perform (multi, &running);
+        if (mc != CURLM_OK)
+        {
+            g_set_error (&local_err, KALU_ERROR, 1, "%s", curl_multi_strerror (mc));
+            goto done;
+        }
+
+        while ((msg = curl_multi_info_read (multi, &left)))
+        {
+            transfer_t *transfer;
+            char *content;
+
+            if (msg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+
+            curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+            curl_multi_remove_handle (multi, transfer->curl);
+            transfers = alpm_list_remove (transfers, transfer,
+                    (alpm_list_fn_cmp) ptr_cmp, NULL);
+
+            /* can't retry once something was streamed to the sink */
+            if (transfer->attempt < (guint) config->download_retries
+                    && transfer->sink.len == 0)
+            {
+                long code = 0;
+
+                curl_easy_getinfo (transfer->curl, CURLINFO_RESPONSE_CODE, &code);
+                if (is_transient (msg->data.result, code))
+                {
+                    gulong delay = get_retry_delay (transfer->attempt++);
+
+                    debug ("downloading %s failed, retrying in %lums",
+                            transfer->url, delay / 1000);
+                    transfer->data.len = 0;
+                    transfer->retry_at = g_get_monotonic_time () + (gint64) delay;
+                    if (next_retry == 0 || transfer->retry_at < next_retry)
+                    {
+                        next_retry = transfer->retry_at;
+                    }
+                    transfers = alpm_list_add (transfers, transfer);
+                    continue;
+                }
+            }
+
+            if (msg->data.result == CURLE_WRITE_ERROR && transfer->sink.is_done)
+            {
+                debug ("downloading %s stopped early, the rest isn't needed",
+                        transfer->url);
+            }
+            else if (msg->data.result != CURLE_OK)
+            {
+                gboolean may_fail = transfer->request->may_fail;
+                GError **err = (may_fail) ? &transfer->request->error : &local_err;
+
+                if (transfer->sink.error)
+                {
+                    g_propagate_error (err, transfer->sink.error);
+                    transfer->sink.error = NULL;
+                }
+                else
+                {
+                    g_set_error (err, KALU_ERROR, 1, "%s",
+                            (transfer->errmsg[0] != '\0')
+                            ? transfer->errmsg
+                            : curl_easy_strerror (msg->data.result));
+                }
+                if (may_fail)
+                {
+                    debug ("downloading %s failed: %s", transfer->url,
+                            transfer->request->error->message);
+                    free_transfer (transfer, FALSE);
+                    continue;
+                }
+                free_transfer (transfer, FALSE);
+                goto done;
+            }
+
+            {
+                long filetime = -1;
+
+                curl_easy_getinfo (transfer->curl, CURLINFO_FILETIME, &filetime);
+                transfer->request->filetime = (filetime > 0) ? (time_t) filetime : 0;
+            }
+            transfer->request->is_modified = TRUE;
+            if (transfer->request->if_modified_since > 0)
+            {
+                long unmet = 0;
+
+                curl_easy_getinfo (transfer->curl, CURLINFO_CONDITION_UNMET, &unmet);
+                transfer->request->is_modified = !unmet;
+            }
+
+            content = NULL;
+            if (transfer->request->cache_name)
+            {
+                long code = 0;
+
+                curl_easy_getinfo (transfer->curl, CURLINFO_RESPONSE_CODE, &code);
+                transfer->request->is_modified = (code != 304);
+                if (code == 304)
+                {
+                    gchar *cached;
+
+                    if (!g_file_get_contents (transfer->file, &cached, NULL, NULL))
+                    {
+                        /* cache vanished in the meantime, just download it
+                         * again */
+                        debug ("cache %s vanished, downloading %s again",
+                                transfer->file, transfer->url);
+                        unlink (transfer->file_validators);
+                        curl_easy_setopt (transfer->curl, CURLOPT_HTTPHEADER, NULL);
+                        curl_slist_free_all (transfer->headers);
+                        transfer->headers = NULL;
+                        transfer->data.len = 0;
+                        curl_multi_add_handle (multi, transfer->curl);
+                        transfers = alpm_list_add (transfers, transfer);
+                        continue;
+                    }
+                    debug ("not modified, using cache %s", transfer->file);
+                    free (transfer->data.content);
+                    transfer->data.content = content = cached;
+                }
+                /* not when stopped early, since content is then incomplete */
+                else if (code == 200 && !transfer->sink.is_done)
+                {
+                    if (!transfer->request->sink_fn)
+                    {
+                        content = finish_download (&transfer->data);
+                    }
+                    save_cache (transfer->file, transfer->file_validators,
+                            &transfer->data, &transfer->validators);
+                }
+            }
+            if (!content && !transfer->request->sink_fn)
+            {
+                content = finish_download (&transfer->data);
+            }
+            if (!callback (transfer->request, content, cb_data, &local_err))
+            {
+                free_transfer (transfer, TRUE);
+                goto done;
+            }
+            free_transfer (transfer, TRUE);
+        }
+
+        if (running > 0 || next_retry > 0)
+        {
+            int timeout = 1000;
+
+            if (next_retry > 0)
+            {
+                now = g_get_monotonic_time ();
+                timeout = (int) CLAMP ((next_retry - now) / 1000, 0, 1000);
+            }
+            mc = curl_multi_wait (multi, NULL, 0, timeout, NULL);
+            if (mc != CURLM_OK)
+            {
+                g_set_error (&local_err, KALU_ERROR, 1, "%s",
+                        curl_multi_strerror (mc));
+                goto done;
+            }
+        }
+    }
+
+done:
+    FOR_LIST (i, transfers)
+    {
+        transfer_t *transfer = i->data;
+
+        curl_multi_remove_handle (multi, transfer->curl);
+        free_transfer (transfer, FALSE);
+    }
+    alpm_list_free (transfers);
+    curl_multi_cleanup (multi);
+
+    if (local_err)
+    {
+        g_propagate_error (error, local_err);
+        return FALSE;
+    }
+    return TRUE;
+}
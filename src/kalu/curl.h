@@ -23,10 +23,114 @@
 #ifndef _KALU_CURL_H
 #define _KALU_CURL_H
 
+/* C */
+#include <time.h>
+
 /* glib */
 #include <glib-2.0/glib.h>
 
+/* alpm */
+#include <alpm_list.h>
+
+typedef struct _curl_stats_t {
+    guint   nb_transfers;   /* successful transfers */
+    guint   nb_connects;    /* new connections opened */
+    guint   nb_reused;      /* transfers done over a re-used connection */
+} curl_stats_t;
+
+/* called with each chunk of data as it is downloaded; returning FALSE aborts
+ * the download. Returning FALSE without setting error means the sink is done,
+ * i.e. doesn't need the rest: that isn't a failure, the sink won't be called
+ * again and the transfer is stopped (so what was received isn't cached) */
+typedef gboolean (*curl_sink_fn) (const char   *chunk,
+                                  size_t        len,
+                                  gpointer      data,
+                                  GError      **error);
+
+/* a download for curl_download_multi() */
+typedef struct _curl_request_t {
+    const char      *url;
+    char            *post;      /* if not NULL, data to send via POST */
+    curl_sink_fn     sink_fn;   /* if not NULL, content is streamed to it */
+    gpointer         sink_data;
+    const char      *cache_name; /* if not NULL, conditional download cached as
+                                  * such, see curl_download_cached() */
+    time_t           if_modified_since; /* if not 0, conditional download */
+    gboolean         may_fail;  /* if TRUE, a failure doesn't stop everything:
+                                 * error is set instead (and the callback isn't
+                                 * called) */
+    /* set on completion */
+    gboolean         is_modified; /* FALSE if from cache/not modified since */
+    time_t           filetime;  /* remote time of the file, 0 if unknown */
+    GError          *error;     /* with may_fail, to be free-d by the caller */
+} curl_request_t;
+
+/* called by curl_download_multi() when a download is complete; content is
+ * NULL if it was streamed to the request's sink_fn (but not when coming from
+ * cache, i.e. not modified, since then nothing was streamed) */
+typedef gboolean (*curl_multi_cb) (curl_request_t  *request,
+                                   char            *content,
+                                   gpointer         data,
+                                   GError         **error);
+
+/* timing breakdown of a transfer (times in microseconds) */
+typedef struct _curl_metrics_t {
+    char       *url;
+    gboolean    is_success;
+    gboolean    is_reused;      /* connection was re-used */
+    guint64     namelookup;
+    guint64     connect;
+    guint64     appconnect;     /* TLS handshake done */
+    guint64     starttransfer;  /* first byte received */
+    guint64     total;
+    guint64     bytes;          /* downloaded */
+} curl_metrics_t;
+
+gboolean
+curl_pool_init (void);
+
+void
+curl_pool_get_stats (curl_stats_t *stats);
+
+curl_metrics_t *
+curl_pool_get_metrics (guint *nb);
+
+void
+curl_pool_free_metrics (curl_metrics_t *metrics, guint nb);
+
+void
+curl_pool_cleanup (void);
+
 char *
 curl_download (const char *url, GError **error);
 
+gboolean
+curl_download_sink (const char     *url,
+                    curl_sink_fn    sink_fn,
+                    gpointer        sink_data,
+                    GError        **error);
+
+char *
+curl_download_cached (const char   *url,
+                      const char   *cache_name,
+                      curl_sink_fn  sink_fn,
+                      gpointer      sink_data,
+                      gboolean     *is_modified,
+                      GError      **error);
+
+gboolean
+curl_download_revalidate (const char   *url,
+                          const char   *cache_name,
+                          curl_sink_fn  sink_fn,
+                          gpointer      sink_data,
+                          gboolean     *is_modified,
+                          GError      **error);
+
+gboolean
+curl_download_multi (alpm_list_t    *requests,
+                     guint           max_parallel,
+                     curl_multi_cb   callback,
+                     gpointer        cb_data,
+                     GError        **error);
+
 #endif /* _KALU_CURL_H */
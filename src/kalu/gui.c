@@ -71,9 +71,17 @@ free_notif (notif_t *notif)
 
     free (notif->summary);
     free (notif->text);
-    if (notif->type == CHECK_NEWS || notif->type == CHECK_AUR)
+    if (notif->type == CHECK_NEWS)
     {
-        /* CHECK_NEWS has xml_news; CHECK_AUR has cmdline w/ $PACKAGES replaced */
+        /* CHECK_NEWS has a reference to the parsed news */
+        if (notif->data)
+        {
+            news_unref (notif->data);
+        }
+    }
+    else if (notif->type == CHECK_AUR)
+    {
+        /* CHECK_AUR has cmdline w/ $PACKAGES replaced */
         free (notif->data);
     }
     else
@@ -379,7 +387,7 @@ action_news (NotifyNotification *notification, char *action _UNUSED_,
     if (notif->data)
     {
         set_kalpm_busy (TRUE);
-        if (!news_show ((gchar *) notif->data, TRUE, &error))
+        if (!news_show ((news_t *) notif->data, TRUE, &error))
         {
             show_error (_("Unable to show the news"), error->message, NULL);
             g_clear_error (&error);
@@ -20,6 +20,7 @@
  * kalu. If not, see http://www.gnu.org/licenses/
  */
 
+#define _GNU_SOURCE /* copy_file_range() */
 #include <config.h>
 
 /* C */
@@ -27,10 +28,20 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <utime.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>   /* FICLONE */
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 /* alpm */
 #include <alpm.h>
@@ -44,6 +55,7 @@
 #include "kalu-alpm.h"
 #include "util.h"
 #include "conf.h"
+#include "curl.h"
 
 /* global variable */
 unsigned short alpm_verbose;
@@ -53,35 +65,181 @@ static kalu_alpm_t *alpm;
 static gchar *tmp_dbpath = NULL;
 static gboolean is_tmp_dbpath_set = FALSE;
 
+/* the ALPM session (handle & registered DBs) is kept from one check to the
+ * next, as long as inotify doesn't report any change to what it was loaded
+ * from: pacman.conf (& Includes), local & sync DBs, or our tmp dbpath */
+static struct {
+    int      fd;        /* inotify; -1 if there's no session to keep */
+    gchar   *conffile;  /* set once loaded, i.e. the session can be kept */
+    time_t   started;   /* when loading started */
+} session = { -1, NULL, 0 };
+
+/* results of the last checks, along with a fingerprint of what they were
+ * computed from (DBs & lists given), to be re-used as long as it matches */
+enum {
+    MEMO_UPDATES = 0,
+    MEMO_WATCHED,
+    MEMO_FOREIGN,   /* packages are from the localdb, i.e. alpm_pkg_t */
+    _NB_MEMOS
+};
+static struct {
+    gchar       *fingerprint;
+    alpm_list_t *packages;
+} memos[_NB_MEMOS];
+
 static gboolean copy_file (const gchar *from, const gchar *to);
 static gboolean create_local_db (const gchar *dbpath, gchar **newpath,
         GString **_synced_dbs, GError **error);
 
 
 
+/* copies size bytes from fd_from into fd_to (from their current offsets),
+ * without going through userspace when possible: sharing the data (reflink)
+ * where the filesystem supports it, else copy_file_range() or sendfile(),
+ * with a plain read/write as last resort */
+static gboolean
+copy_data (int fd_from, int fd_to, off_t size)
+{
+    gchar   buf[65536];
+    off_t   done = 0;
+    ssize_t n;
+
+#ifdef FICLONE
+    if (ioctl (fd_to, FICLONE, fd_from) == 0)
+    {
+        debug ("..cloned");
+        return TRUE;
+    }
+#endif
+
+    /* those fail right away when not supported (e.g. across filesystems on
+     * older kernels); Both move the offsets, so each one goes on from where the
+     * previous one stopped */
+#ifdef HAVE_COPY_FILE_RANGE
+    while (done < size)
+    {
+        n = copy_file_range (fd_from, NULL, fd_to, NULL, (size_t) (size - done), 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n <= 0)
+        {
+            break;
+        }
+        done += n;
+    }
+#endif
+#ifdef HAVE_SENDFILE
+    while (done < size)
+    {
+        n = sendfile (fd_to, fd_from, NULL, (size_t) (size - done));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n <= 0)
+        {
+            break;
+        }
+        done += n;
+    }
+#endif
+    if (done >= size)
+    {
+        return TRUE;
+    }
+
+    debug ("..falling back to read/write");
+    for (;;)
+    {
+        gchar *b = buf;
+
+        n = read (fd_from, buf, sizeof (buf));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n <= 0)
+        {
+            return n == 0;
+        }
+
+        while (n > 0)
+        {
+            ssize_t w;
+
+            w = write (fd_to, b, (size_t) n);
+            if (w < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (w < 0)
+            {
+                return FALSE;
+            }
+            b += w;
+            n -= w;
+        }
+    }
+}
+
+/* like g_file_set_contents(), to is written as a new file which then replaces
+ * it, so it can't be left half-written; But content never goes through memory
+ * (see copy_data()) */
 static gboolean
 copy_file (const gchar *from, const gchar *to)
 {
-    gchar *contents;
-    gsize  length;
+    struct stat  st;
+    gchar       *tmp;
+    int          fd_from, fd_to;
+    gboolean     ret;
 
     debug ("copying %s to %s", from, to);
 
-    if (!g_file_get_contents (from, &contents, &length, NULL))
+    do
+        fd_from = open (from, O_RDONLY);
+    while (fd_from < 0 && errno == EINTR);
+    if (fd_from < 0 || fstat (fd_from, &st) < 0)
     {
         debug ("cannot read %s", from);
+        if (fd_from >= 0)
+        {
+            close (fd_from);
+        }
         return FALSE;
     }
 
-    if (!g_file_set_contents (to, contents, (gssize) length, NULL))
+    tmp = g_strdup_printf ("%s.XXXXXX", to);
+    fd_to = g_mkstemp (tmp);
+    if (fd_to < 0)
     {
         debug ("cannot write %s", to);
-        g_free (contents);
+        close (fd_from);
+        g_free (tmp);
+        return FALSE;
+    }
+
+    ret = copy_data (fd_from, fd_to, st.st_size);
+    close (fd_from);
+    if (close (fd_to) < 0)
+    {
+        ret = FALSE;
+    }
+    if (ret && rename (tmp, to) < 0)
+    {
+        ret = FALSE;
+    }
+    if (!ret)
+    {
+        debug ("cannot write %s", to);
+        unlink (tmp);
+        g_free (tmp);
         return FALSE;
     }
 
     debug ("..done");
-    g_free (contents);
+    g_free (tmp);
     return TRUE;
 }
 
@@ -477,6 +635,168 @@ log_cb (alpm_loglevel_t level, const char *fmt, va_list args)
     g_free (s);
 }
 
+#ifdef HAVE_SYS_INOTIFY_H
+static gboolean
+add_watch (int fd, const gchar *path, uint32_t mask)
+{
+    if (inotify_add_watch (fd, path, mask) < 0)
+    {
+        debug ("unable to watch %s: %s", path, strerror (errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+#endif
+
+static void
+session_forget (void)
+{
+    if (session.fd >= 0)
+    {
+        close (session.fd);
+        session.fd = -1;
+    }
+    g_free (session.conffile);
+    session.conffile = NULL;
+}
+
+/* whether anything changed since watching started (errors counting as such) */
+static gboolean
+session_has_changes (void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    gchar   buf[4096]
+        __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    ssize_t n;
+
+    do
+        n = read (session.fd, buf, sizeof (buf));
+    while (n < 0 && errno == EINTR);
+    /* nothing to read means no changes */
+    return n >= 0 || errno != EAGAIN;
+#else
+    return TRUE;
+#endif
+}
+
+/* Watching what the session is loaded from is set up as it gets known, before
+ * it's read, so no change can be missed: first pacman.conf */
+static void
+session_watch_conf (const gchar *conffile)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    session.fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (session.fd < 0)
+    {
+        debug ("unable to init inotify: %s", strerror (errno));
+        return;
+    }
+    session.started = time (NULL);
+
+    if (!add_watch (session.fd, conffile,
+                IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+        session_forget ();
+    }
+#else
+    (void) conffile;
+#endif
+}
+
+/* then, once it's parsed, its Includes & the DBs */
+static void
+session_watch_dbs (pacman_config_t *pac_conf)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    gchar        buf[PATH_MAX];
+    alpm_list_t *i;
+    gboolean     ok = TRUE;
+
+    if (session.fd < 0)
+    {
+        return;
+    }
+
+    FOR_LIST (i, pac_conf->files)
+    {
+        struct stat st;
+
+        ok = ok && add_watch (session.fd, i->data,
+                IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+        /* Includes were read before being watched, so they might have changed
+         * in between (going by seconds, to be safe) */
+        if (ok && (stat (i->data, &st) < 0 || st.st_mtime >= session.started))
+        {
+            debug ("%s changed while loading", (const char *) i->data);
+            ok = FALSE;
+        }
+    }
+    /* packages (un)installed/upgraded */
+    snprintf (buf, PATH_MAX, "%s/local", pac_conf->dbpath);
+    ok = ok && add_watch (session.fd, buf, IN_CREATE | IN_DELETE | IN_MOVED_FROM
+            | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    /* sync DBs updated (e.g. pacman -Sy) */
+    snprintf (buf, PATH_MAX, "%s/sync", pac_conf->dbpath);
+    ok = ok && add_watch (session.fd, buf, IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE
+            | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF
+            | IN_MOVE_SELF);
+
+    if (!ok)
+    {
+        session_forget ();
+    }
+#else
+    (void) pac_conf;
+#endif
+}
+
+/* and finally our copy, once made. The session is only kept if nothing changed
+ * while it was being loaded */
+static void
+session_keep (const gchar *conffile)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    if (session.fd < 0)
+    {
+        return;
+    }
+
+    if (!add_watch (session.fd, alpm->dbpath, IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+        session_forget ();
+        return;
+    }
+    if (session_has_changes ())
+    {
+        debug ("changes detected while loading, ALPM session not kept");
+        session_forget ();
+        return;
+    }
+    session.conffile = g_strdup (conffile);
+#else
+    (void) conffile;
+#endif
+}
+
+/* whether the session can be re-used, i.e. nothing changed since it was
+ * loaded */
+static gboolean
+session_is_valid (const gchar *conffile)
+{
+    if (!alpm || session.fd < 0 || !session.conffile
+            || !streq (conffile, session.conffile))
+    {
+        return FALSE;
+    }
+
+    if (session_has_changes ())
+    {
+        debug ("ALPM session outdated, changes were detected");
+        return FALSE;
+    }
+    return TRUE;
+}
+
 gboolean
 kalu_alpm_set_tmp_dbpath (const gchar *path)
 {
@@ -501,14 +821,32 @@ kalu_alpm_load (kalu_simul_t    *simulation,
     pacman_config_t    *pac_conf = NULL;
     gchar              *section = NULL;
 
+    /* re-use the session from last time, unless something changed. Never for
+     * a simulation (i.e. the updater), which needs its own callbacks */
+    if (!simulation && session_is_valid (conffile))
+    {
+        debug ("re-using ALPM session");
+        return TRUE;
+    }
+    kalu_alpm_free ();
+    if (!simulation)
+    {
+        session_watch_conf (conffile);
+    }
+
     /* parse pacman.conf */
     debug ("parsing pacman.conf (%s) for options", conffile);
     if (!parse_pacman_conf (conffile, &section, 0, 0, &pac_conf, &local_err))
     {
         g_propagate_error (error, local_err);
         free_pacman_config (pac_conf);
+        session_forget ();
         return FALSE;
     }
+    if (!simulation)
+    {
+        session_watch_dbs (pac_conf);
+    }
 
     debug ("setting up libalpm");
     alpm = new0 (kalu_alpm_t, 1);
@@ -649,16 +987,352 @@ kalu_alpm_load (kalu_simul_t    *simulation,
     alpm_verbose = pac_conf->verbosepkglists;
 
     if (!simulation)
+    {
+        session_keep (conffile);
         free_pacman_config (pac_conf);
+    }
+    return TRUE;
+}
+
+/* a file (DB or its signature) downloaded by kalu_alpm_syncdbs() */
+typedef struct _db_file_t {
+    curl_request_t   request;
+    gchar           *url;
+    gchar            file[PATH_MAX];
+    gchar            part[PATH_MAX];    /* downloaded as, until complete */
+    FILE            *fp;
+} db_file_t;
+
+/* a sync DB downloaded by kalu_alpm_syncdbs() */
+typedef struct _db_sync_t {
+    db_file_t        db;
+    db_file_t        sig;
+    int              siglevel;  /* of the DB, if its signature is downloaded */
+    int              ret;   /* as alpm_db_update(); -1 to leave it to libalpm */
+} db_sync_t;
+
+static gboolean
+db_file_write (const char *chunk, size_t len, db_file_t *dbf, GError **error)
+{
+    /* only opened once there's something, so nothing is left behind when not
+     * modified */
+    if (!dbf->fp)
+    {
+        dbf->fp = fopen (dbf->part, "w");
+        if (!dbf->fp)
+        {
+            g_set_error (error, KALU_ERROR, 1, _("Unable to open %s for writing"),
+                    dbf->part);
+            return FALSE;
+        }
+    }
+    if (fwrite (chunk, 1, len, dbf->fp) != len)
+    {
+        g_set_error (error, KALU_ERROR, 1, _("Unable to write to %s"), dbf->part);
+        return FALSE;
+    }
     return TRUE;
 }
 
+static gboolean
+db_file_close (db_file_t *dbf)
+{
+    int r;
+
+    if (!dbf->fp)
+    {
+        return FALSE;
+    }
+    r = fclose (dbf->fp);
+    dbf->fp = NULL;
+    return r == 0;
+}
+
+static gboolean
+db_file_downloaded (curl_request_t *request, char *content _UNUSED_,
+                    gpointer data _UNUSED_, GError **error _UNUSED_)
+{
+    db_file_t *dbf = request->sink_data;
+
+    if (dbf->fp && !db_file_close (dbf))
+    {
+        debug ("unable to write %s", dbf->part);
+        unlink (dbf->part);
+        request->is_modified = FALSE;
+        g_set_error (&request->error, KALU_ERROR, 1,
+                _("Unable to write to %s"), dbf->part);
+    }
+    return TRUE;
+}
+
+static gboolean
+db_file_setup (db_file_t *dbf, const char *server, const char *name,
+               const char *ext)
+{
+    struct stat st;
+
+    if (snprintf (dbf->file, PATH_MAX, "%s/sync/%s%s", alpm->dbpath, name, ext)
+            >= PATH_MAX - 5)
+    {
+        return FALSE;
+    }
+    snprintf (dbf->part, PATH_MAX, "%s.part", dbf->file);
+    dbf->url = g_strdup_printf ("%s/%s%s", server, name, ext);
+    dbf->request.url = dbf->url;
+    dbf->request.sink_fn = (curl_sink_fn) db_file_write;
+    dbf->request.sink_data = dbf;
+    dbf->request.may_fail = TRUE;
+    /* like libalpm, rely on the mtime of our copy, which is set to that of the
+     * remote file */
+    if (stat (dbf->file, &st) == 0)
+    {
+        dbf->request.if_modified_since = st.st_mtime;
+    }
+    return TRUE;
+}
+
+static gboolean
+db_file_install (db_file_t *dbf)
+{
+    if (rename (dbf->part, dbf->file) < 0)
+    {
+        debug ("unable to rename %s: %s", dbf->part, strerror (errno));
+        unlink (dbf->part);
+        return FALSE;
+    }
+    if (dbf->request.filetime > 0)
+    {
+        struct utimbuf times;
+
+        times.actime = dbf->request.filetime;
+        times.modtime = dbf->request.filetime;
+        if (0 != utime (dbf->file, &times))
+        {
+            /* next sync will simply download it again */
+            debug ("Unable to change time of %s", dbf->file);
+        }
+    }
+    return TRUE;
+}
+
+/* puts downloaded files into place; returns as alpm_db_update() would, with
+ * -1 meaning libalpm should be left to do it (e.g. try other servers) */
+static int
+db_sync_finish (db_sync_t *sync)
+{
+    db_file_t *db = &sync->db;
+    db_file_t *sig = &sync->sig;
+    if (db->request.error)
+    {
+        unlink (db->part);
+        unlink (sig->part);
+        return -1;
+    }
+    if (!db->request.is_modified)
+    {
+        unlink (sig->part);
+        return 1;
+    }
+    if (access (db->part, F_OK) < 0)
+    {
+        debug ("%s: nothing downloaded", db->url);
+        unlink (sig->part);
+        return -1;
+    }
+    if (sync->siglevel & ALPM_SIG_DATABASE)
+    {
+        if (!sig->request.error && !sig->request.is_modified)
+        {
+            /* what we have is still what's on the server */
+        }
+        else if (sig->request.error || access (sig->part, F_OK) < 0)
+        {
+            if (!(sync->siglevel & ALPM_SIG_DATABASE_OPTIONAL))
+            {
+                debug ("%s: no signature", sig->url);
+                unlink (db->part);
+                unlink (sig->part);
+                return -1;
+            }
+            /* don't keep one from a previous version */
+            unlink (sig->file);
+        }
+        else if (!db_file_install (sig))
+        {
+            unlink (db->part);
+            return -1;
+        }
+    }
+    if (!db_file_install (db))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* libalpm only drops what it had loaded from a DB when updating it itself, so
+ * DBs are registered anew (all of them, to preserve order) for what we
+ * downloaded to be used */
+static gboolean
+reregister_syncdbs (GError **error)
+{
+    typedef struct {
+        gchar           *name;
+        int              siglevel;
+        alpm_list_t     *servers;
+    } db_conf_t;
+    alpm_list_t *dbs = NULL, *i, *j;
+    gboolean success = TRUE;
+
+    FOR_LIST (i, alpm_get_syncdbs (alpm->handle))
+    {
+        db_conf_t *dbc = new (db_conf_t, 1);
+
+        dbc->name = strdup (alpm_db_get_name (i->data));
+        dbc->siglevel = alpm_db_get_siglevel (i->data);
+        dbc->servers = alpm_list_strdup (alpm_db_get_servers (i->data));
+        dbs = alpm_list_add (dbs, dbc);
+    }
+
+    alpm_unregister_all_syncdbs (alpm->handle);
+    FOR_LIST (i, dbs)
+    {
+        db_conf_t *dbc = i->data;
+        alpm_db_t *db;
+
+        if (success)
+        {
+            debug ("register %s", dbc->name);
+            db = alpm_register_syncdb (alpm->handle, dbc->name, dbc->siglevel);
+            if (!db)
+            {
+                g_set_error (error, KALU_ERROR, 1,
+                        _("Could not register database %s: %s"),
+                        dbc->name, alpm_strerror (alpm_errno (alpm->handle)));
+                success = FALSE;
+            }
+            FOR_LIST (j, dbc->servers)
+            {
+                if (success && alpm_db_add_server (db, j->data) != 0)
+                {
+                    g_set_error (error, KALU_ERROR, 1,
+                            _("Could not add server %s to database %s: %s"),
+                            (const char *) j->data, dbc->name,
+                            alpm_strerror (alpm_errno (alpm->handle)));
+                    success = FALSE;
+                }
+            }
+        }
+        free (dbc->name);
+        FREELIST (dbc->servers);
+        free (dbc);
+    }
+    alpm_list_free (dbs);
+
+    return success;
+}
+
+/* downloads the sync DBs (& signatures) concurrently, which libalpm can't do.
+ * Returns an array of db_sync_t, in the order of sync_dbs, whose ret tells
+ * what was done: DBs that failed (ret == -1) are left to libalpm */
+static db_sync_t *
+download_syncdbs (alpm_list_t *sync_dbs)
+{
+    db_sync_t *syncs;
+    alpm_list_t *requests = NULL, *i;
+    GError *local_err = NULL;
+    gboolean success;
+    int n;
+
+    syncs = new0 (db_sync_t, alpm_list_count (sync_dbs));
+    for (i = sync_dbs, n = 0; i; i = i->next, ++n)
+    {
+        alpm_db_t *db = i->data;
+        alpm_list_t *servers = alpm_db_get_servers (db);
+        db_sync_t *sync = &syncs[n];
+
+        sync->ret = -1;
+        if (!servers)
+        {
+            continue;
+        }
+        if (!db_file_setup (&sync->db, servers->data, alpm_db_get_name (db), ".db"))
+        {
+            continue;
+        }
+
+        /* fetched alongside, since we can't know yet whether the DB will
+         * have changed */
+        sync->siglevel = alpm_db_get_siglevel (db);
+        if (sync->siglevel & ALPM_SIG_DATABASE)
+        {
+            if (!db_file_setup (&sync->sig, servers->data, alpm_db_get_name (db),
+                        ".db.sig"))
+            {
+                /* leave the whole DB to libalpm */
+                g_free (sync->db.url);
+                sync->db.url = NULL;
+                continue;
+            }
+            requests = alpm_list_add (requests, &sync->sig.request);
+        }
+        requests = alpm_list_add (requests, &sync->db.request);
+    }
+
+    success = curl_download_multi (requests, (guint) config->syncdbs_parallel,
+            db_file_downloaded, NULL, &local_err);
+    if (!success)
+    {
+        /* can only be from cURL itself, since all downloads may fail */
+        debug ("downloading sync DBs failed: %s", local_err->message);
+        g_clear_error (&local_err);
+    }
+    alpm_list_free (requests);
+
+    for (i = sync_dbs, n = 0; i; i = i->next, ++n)
+    {
+        db_sync_t *sync = &syncs[n];
+
+        /* in case the transfer was aborted */
+        db_file_close (&sync->db);
+        db_file_close (&sync->sig);
+        if (success && sync->db.url)
+        {
+            sync->ret = db_sync_finish (sync);
+        }
+        else if (sync->db.url)
+        {
+            unlink (sync->db.part);
+            unlink (sync->sig.part);
+        }
+        debug ("%s: %s", alpm_db_get_name (i->data),
+                (sync->ret == 0) ? "downloaded"
+                : (sync->ret == 1) ? "not modified" : "left to libalpm");
+        g_free (sync->db.url);
+        g_free (sync->sig.url);
+        if (sync->db.request.error)
+        {
+            g_error_free (sync->db.request.error);
+        }
+        if (sync->sig.request.error)
+        {
+            g_error_free (sync->sig.request.error);
+        }
+    }
+
+    return syncs;
+}
+
 gboolean
 kalu_alpm_syncdbs (GString **_synced_dbs, GError **error)
 {
     alpm_list_t     *sync_dbs   = NULL;
     alpm_list_t     *i;
     GError          *local_err  = NULL;
+    db_sync_t       *syncs      = NULL;
+    gboolean         reregister = FALSE;
+    gboolean         success    = TRUE;
+    int              n;
     int              ret;
 
     if (!check_syncdbs (alpm, 1, 0, &local_err))
@@ -672,7 +1346,17 @@ kalu_alpm_syncdbs (GString **_synced_dbs, GError **error)
     if (alpm->simulation)
         alpm->simulation->on_sync_dbs (NULL, (gint) alpm_list_count (sync_dbs));
 #endif
-    FOR_LIST (i, sync_dbs)
+    /* the updater shows progress of each DB as it's being synced, so it's left
+     * to libalpm, one after another */
+    if (config->syncdbs_parallel > 1 && alpm_list_count (sync_dbs) > 1
+#ifndef DISABLE_UPDATER
+            && !alpm->simulation
+#endif
+            )
+    {
+        syncs = download_syncdbs (sync_dbs);
+    }
+    for (i = sync_dbs, n = 0; i; i = i->next, ++n)
     {
         alpm_db_t *db = i->data;
 
@@ -680,14 +1364,23 @@ kalu_alpm_syncdbs (GString **_synced_dbs, GError **error)
         if (alpm->simulation)
             alpm->simulation->on_sync_db_start (NULL, alpm_db_get_name (db));
 #endif
-        ret = alpm_db_update (0, db);
+        ret = (syncs) ? syncs[n].ret : -1;
+        if (ret == 0)
+        {
+            reregister = TRUE;
+        }
+        else if (ret < 0)
+        {
+            ret = alpm_db_update (0, db);
+        }
         if (ret < 0)
         {
             g_set_error (error, KALU_ERROR, 1,
                     _("Failed to update %s: %s"),
                     alpm_db_get_name (db),
                     alpm_strerror (alpm_errno (alpm->handle)));
-            return FALSE;
+            success = FALSE;
+            break;
         }
         else if (ret == 1)
         {
@@ -731,12 +1424,213 @@ kalu_alpm_syncdbs (GString **_synced_dbs, GError **error)
         }
 #endif
     }
+    free (syncs);
 
+    /* even on failure, since the DB files were replaced. Signatures will be
+     * verified as usual, when DBs are then checked to be valid */
+    if (reregister && !reregister_syncdbs ((success) ? error : NULL))
+    {
+        success = FALSE;
+    }
+
+    return success;
+}
+
+/* fingerprint of the local DB & all sync DBs, going by their mtime (& size);
+ * Check-specific bits are then to be appended. Returns NULL if results can't
+ * be memoized */
+static GString *
+get_fingerprint (void)
+{
+    GString *fp;
+    gchar buf[PATH_MAX];
+    struct stat st;
+    alpm_list_t *i;
+
+#ifndef DISABLE_UPDATER
+    /* the updater has its own transaction going on */
+    if (alpm->simulation)
+    {
+        return NULL;
+    }
+#endif
+
+    /* a symlink to the actual localdb, whose mtime changes whenever packages
+     * are installed/upgraded/removed */
+    snprintf (buf, PATH_MAX, "%s/local", alpm->dbpath);
+    if (stat (buf, &st) < 0)
+    {
+        return NULL;
+    }
+    fp = g_string_sized_new (255);
+    g_string_append_printf (fp, "local:%ld.%ld;",
+            (long) st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+
+    FOR_LIST (i, alpm_get_syncdbs (alpm->handle))
+    {
+        const char *dbname = alpm_db_get_name (i->data);
+
+        if (snprintf (buf, PATH_MAX, "%s/sync/%s.db", alpm->dbpath, dbname)
+                >= PATH_MAX || stat (buf, &st) < 0)
+        {
+            g_string_free (fp, TRUE);
+            return NULL;
+        }
+        g_string_append_printf (fp, "%s:%ld.%ld:%ld;", dbname,
+                (long) st.st_mtim.tv_sec, st.st_mtim.tv_nsec, (long) st.st_size);
+    }
+
+    return fp;
+}
+
+static alpm_list_t *
+copy_packages (alpm_list_t *packages)
+{
+    alpm_list_t *copy = NULL;
+    alpm_list_t *i;
+
+    FOR_LIST (i, packages)
+    {
+        kalu_package_t *pkg = i->data;
+        kalu_package_t *package;
+
+        package = new0 (kalu_package_t, 1);
+        package->repo = (pkg->repo) ? strdup (pkg->repo) : NULL;
+        package->name = strdup (pkg->name);
+        package->desc = strdup (pkg->desc);
+        package->old_version = strdup (pkg->old_version);
+        package->new_version = strdup (pkg->new_version);
+        package->dl_size = pkg->dl_size;
+        package->old_size = pkg->old_size;
+        package->new_size = pkg->new_size;
+        package->ignored = pkg->ignored;
+
+        copy = alpm_list_add (copy, package);
+    }
+
+    return copy;
+}
+
+static void
+memo_forget (int memo)
+{
+    g_free (memos[memo].fingerprint);
+    memos[memo].fingerprint = NULL;
+    if (memo == MEMO_FOREIGN)
+    {
+        alpm_list_free (memos[memo].packages);
+    }
+    else
+    {
+        FREE_PACKAGE_LIST (memos[memo].packages);
+    }
+    memos[memo].packages = NULL;
+}
+
+/* if fp matches, puts a copy of the memoized results into packages */
+static gboolean
+memo_get (int memo, GString *fp, alpm_list_t **packages)
+{
+    if (!fp || !memos[memo].fingerprint || !streq (fp->str, memos[memo].fingerprint))
+    {
+        return FALSE;
+    }
+
+    debug ("nothing changed, re-using results from last check");
+    *packages = (memo == MEMO_FOREIGN)
+        ? alpm_list_copy (memos[memo].packages)
+        : copy_packages (memos[memo].packages);
+    g_string_free (fp, TRUE);
     return TRUE;
 }
 
-gboolean
-kalu_alpm_has_updates (alpm_list_t **packages, GError **error)
+/* memoizes packages as results for fp (taken over), or forgets all about it if
+ * there was an error */
+static void
+memo_set (int memo, GString *fp, alpm_list_t *packages, GError *error)
+{
+    memo_forget (memo);
+    if (!fp)
+    {
+        return;
+    }
+    if (error)
+    {
+        g_string_free (fp, TRUE);
+        return;
+    }
+
+    memos[memo].fingerprint = g_string_free (fp, FALSE);
+    memos[memo].packages = (memo == MEMO_FOREIGN)
+        ? alpm_list_copy (packages)
+        : copy_packages (packages);
+}
+
+static kalu_package_t *
+new_upgrade (alpm_pkg_t *pkg, alpm_pkg_t *old)
+{
+    kalu_package_t *package;
+
+    package = new0 (kalu_package_t, 1);
+    package->repo = strdup (alpm_db_get_name (alpm_pkg_get_db (pkg)));
+    package->name = strdup (alpm_pkg_get_name (pkg));
+    package->desc = strdup (alpm_pkg_get_desc (pkg));
+    package->new_version = strdup (alpm_pkg_get_version (pkg));
+    package->dl_size = (guint) alpm_pkg_download_size (pkg);
+    package->new_size = (guint) alpm_pkg_get_isize (pkg);
+    /* we might not have an old package, when an update requires to
+     * install a new package (e.g. after a split) */
+    if (old)
+    {
+        package->old_version = strdup (alpm_pkg_get_version (old));
+        package->old_size = (guint) alpm_pkg_get_isize (old);
+    }
+    else
+    {
+        /* TRANSLATORS: no previous version */
+        package->old_version = strdup (_("none"));
+        package->old_size = 0;
+    }
+
+    return package;
+}
+
+/* what a sysupgrade would upgrade, going by versions only: no transaction, so
+ * no dependency resolution nor conflict checks. Which means new dependencies
+ * aren't listed, and an upgrade that can't be done isn't detected.
+ * Like libalpm, only the first sync DB having a package is considered, and
+ * packages ignored via IgnorePkg/IgnoreGroup are skipped. Replacements aren't
+ * looked for, since without a question callback (i.e. outside the updater)
+ * libalpm declines them anyways */
+static void
+quick_sysupgrade (alpm_list_t **packages)
+{
+    alpm_list_t *sync_dbs = alpm_get_syncdbs (alpm->handle);
+    alpm_list_t *i;
+
+    FOR_LIST (i, alpm_db_get_pkgcache (alpm_get_localdb (alpm->handle)))
+    {
+        alpm_pkg_t *old = i->data;
+        alpm_pkg_t *pkg;
+
+        pkg = alpm_sync_newversion (old, sync_dbs);
+        if (!pkg)
+        {
+            continue;
+        }
+        if (alpm_pkg_should_ignore (alpm->handle, pkg)
+                || alpm_pkg_should_ignore (alpm->handle, old))
+        {
+            debug ("ignoring upgrade of %s", alpm_pkg_get_name (old));
+            continue;
+        }
+
+        *packages = alpm_list_add (*packages, new_upgrade (pkg, old));
+    }
+}
+
+static gboolean
+has_updates (alpm_list_t **packages, gboolean quick, GError **error)
 {
     alpm_list_t *i;
     alpm_list_t *data       = NULL;
@@ -748,6 +1642,12 @@ kalu_alpm_has_updates (alpm_list_t **packages, GError **error)
         return FALSE;
     }
 
+    if (quick)
+    {
+        quick_sysupgrade (packages);
+        return (*packages != NULL);
+    }
+
     if (!trans_init (alpm, alpm->flags, 1, &local_err))
     {
         g_propagate_error (error, local_err);
@@ -848,30 +1748,8 @@ kalu_alpm_has_updates (alpm_list_t **packages, GError **error)
     {
         alpm_pkg_t *pkg = i->data;
         alpm_pkg_t *old = alpm_db_get_pkg (db_local, alpm_pkg_get_name (pkg));
-        kalu_package_t *package;
 
-        package = new0 (kalu_package_t, 1);
-        package->repo = strdup (alpm_db_get_name (alpm_pkg_get_db (pkg)));
-        package->name = strdup (alpm_pkg_get_name (pkg));
-        package->desc = strdup (alpm_pkg_get_desc (pkg));
-        package->new_version = strdup (alpm_pkg_get_version (pkg));
-        package->dl_size = (guint) alpm_pkg_download_size (pkg);
-        package->new_size = (guint) alpm_pkg_get_isize (pkg);
-        /* we might not have an old package, when an update requires to
-         * install a new package (e.g. after a split) */
-        if (old)
-        {
-            package->old_version = strdup (alpm_pkg_get_version (old));
-            package->old_size = (guint) alpm_pkg_get_isize (old);
-        }
-        else
-        {
-            /* TRANSLATORS: no previous version */
-            package->old_version = strdup (_("none"));
-            package->old_size = 0;
-        }
-
-        *packages = alpm_list_add (*packages, package);
+        *packages = alpm_list_add (*packages, new_upgrade (pkg, old));
     }
 
 #ifndef DISABLE_UPDATER
@@ -906,8 +1784,8 @@ cleanup:
     return (*packages != NULL);
 }
 
-gboolean
-kalu_alpm_has_updates_watched (alpm_list_t **packages, alpm_list_t *watched,
+static gboolean
+has_updates_watched (alpm_list_t **packages, alpm_list_t *watched,
         GError **error)
 {
     alpm_list_t *sync_dbs = alpm_get_syncdbs (alpm->handle);
@@ -991,9 +1869,8 @@ kalu_alpm_has_updates_watched (alpm_list_t **packages, alpm_list_t *watched,
     return (*packages != NULL);
 }
 
-gboolean
-kalu_alpm_has_foreign (alpm_list_t **packages, alpm_list_t *ignore,
-        GError **error)
+static gboolean
+has_foreign (alpm_list_t **packages, alpm_list_t *ignore, GError **error)
 {
     alpm_db_t *dblocal;
     alpm_list_t *sync_dbs, *i, *j;
@@ -1037,6 +1914,93 @@ kalu_alpm_has_foreign (alpm_list_t **packages, alpm_list_t *ignore,
     return (*packages != NULL);
 }
 
+gboolean
+kalu_alpm_has_updates (alpm_list_t **packages, gboolean quick, GError **error)
+{
+    GError *local_err = NULL;
+    GString *fp;
+
+    fp = get_fingerprint ();
+    if (fp)
+    {
+        g_string_append (fp, (quick) ? "quick" : "full");
+    }
+    if (memo_get (MEMO_UPDATES, fp, packages))
+    {
+        return (*packages != NULL);
+    }
+
+    has_updates (packages, quick, &local_err);
+    memo_set (MEMO_UPDATES, fp, *packages, local_err);
+    if (local_err)
+    {
+        g_propagate_error (error, local_err);
+    }
+    return (*packages != NULL);
+}
+
+gboolean
+kalu_alpm_has_updates_watched (alpm_list_t **packages, alpm_list_t *watched,
+        GError **error)
+{
+    GError *local_err = NULL;
+    GString *fp;
+    alpm_list_t *i;
+
+    fp = get_fingerprint ();
+    if (fp)
+    {
+        FOR_LIST (i, watched)
+        {
+            watched_package_t *w_pkg = i->data;
+
+            g_string_append_printf (fp, "%s=%s;", w_pkg->name, w_pkg->version);
+        }
+    }
+    if (memo_get (MEMO_WATCHED, fp, packages))
+    {
+        return (*packages != NULL);
+    }
+
+    has_updates_watched (packages, watched, &local_err);
+    memo_set (MEMO_WATCHED, fp, *packages, local_err);
+    if (local_err)
+    {
+        g_propagate_error (error, local_err);
+    }
+    return (*packages != NULL);
+}
+
+gboolean
+kalu_alpm_has_foreign (alpm_list_t **packages, alpm_list_t *ignore,
+        GError **error)
+{
+    GError *local_err = NULL;
+    GString *fp;
+    alpm_list_t *i;
+
+    fp = get_fingerprint ();
+    if (fp)
+    {
+        FOR_LIST (i, ignore)
+        {
+            g_string_append_printf (fp, "%s;", (const char *) i->data);
+        }
+    }
+    if (memo_get (MEMO_FOREIGN, fp, packages))
+    {
+        return (*packages != NULL);
+    }
+
+    has_foreign (packages, ignore, &local_err);
+    memo_set (MEMO_FOREIGN, fp, *packages, local_err);
+    if (local_err)
+    {
+        g_propagate_error (error, local_err);
+    }
+    return (*packages != NULL);
+}
+
 const gchar *
 kalu_alpm_get_dbpath (void)
 {
@@ -1054,9 +2018,29 @@ kalu_alpm_rmdb (gboolean keep_tmp_dbpath)
     tmp_dbpath = NULL;
 }
 
+/* done with ALPM for now: the session is kept for the next kalu_alpm_load()
+ * if it can be, else freed */
+void
+kalu_alpm_done (void)
+{
+    if (session.fd < 0)
+    {
+        kalu_alpm_free ();
+    }
+}
+
 void
 kalu_alpm_free (void)
 {
+    int memo;
+
+    session_forget ();
+    /* results of has_foreign() point into the localdb, & without the session
+     * nothing tells us the DBs weren't changed in between */
+    for (memo = 0; memo < _NB_MEMOS; ++memo)
+    {
+        memo_forget (memo);
+    }
     if (alpm == NULL)
     {
         return;
@@ -67,7 +67,7 @@ gboolean
 kalu_alpm_syncdbs (GString **_synced_dbs, GError **error);
 
 gboolean
-kalu_alpm_has_updates (alpm_list_t **packages, GError **error);
+kalu_alpm_has_updates (alpm_list_t **packages, gboolean quick, GError **error);
 
 gboolean
 kalu_alpm_has_updates_watched (alpm_list_t **packages, alpm_list_t *watched, GError **error);
@@ -81,6 +81,9 @@ kalu_alpm_get_dbpath (void);
 void
 kalu_alpm_rmdb (gboolean keep_tmp_dbpath);
 
+void
+kalu_alpm_done (void);
+
 void
 kalu_alpm_free (void);
 
@@ -54,6 +54,15 @@
 #define NOTIFY_EXPIRES_NEVER     0
 #endif
 
+#define DEFAULT_AUR_PARALLEL        4   /* max. concurrent requests to the AUR */
+#define DEFAULT_AUR_CACHE_TTL       360 /* in minutes */
+#define DEFAULT_AUR_ARCHIVE_THRESHOLD 1000 /* nb of packages to use the archive */
+#define DEFAULT_CONNECT_TIMEOUT     15  /* in seconds */
+#define DEFAULT_STALL_TIMEOUT       30  /* in seconds */
+#define DEFAULT_DOWNLOAD_TIMEOUT    120 /* in seconds */
+#define DEFAULT_DOWNLOAD_RETRIES    2
+#define DEFAULT_SYNCDBS_PARALLEL    4   /* max. concurrent sync DBs downloads */
+
 #define KALU_ERROR              g_quark_from_static_string ("kalu error")
 
 #define FREE_PACKAGE_LIST(p)    do {                            \
@@ -104,6 +113,12 @@ typedef enum {
     ICON_USER
 } notif_icon_t;
 
+typedef enum {
+    AUR_BACKEND_AUTO = 0,
+    AUR_BACKEND_RPC,
+    AUR_BACKEND_ARCHIVE
+} aur_backend_t;
+
 enum {
     IP_WHATEVER = 0,
     IPv4,
@@ -169,6 +184,12 @@ typedef struct _templates_t {
     struct field fields[_NB_TPL];
 } templates_t;
 
+/* what was read of a news feed, as saved in news.conf */
+typedef struct _news_state_t {
+    char            *last;  /* title of the last item from last check */
+    GHashTable      *read;  /* set of titles of read news */
+} news_state_t;
+
 typedef struct _config_t {
     int              is_debug;
     char            *pacmanconf;
@@ -200,7 +221,17 @@ typedef struct _config_t {
     on_click_t       on_dbl_click_paused;
     on_click_t       on_mdl_click_paused;
     int              use_ip;
+    int              aur_parallel;
+    int              aur_cache_ttl;
+    aur_backend_t    aur_backend;
+    int              aur_archive_threshold;
+    int              connect_timeout;
+    int              stall_timeout;
+    int              download_timeout;
+    int              download_retries;
+    int              syncdbs_parallel;
     gboolean         auto_notifs;
+    gboolean         full_auto_checks;
     gboolean         notif_buttons;
 
     templates_t      templates[_NB_TPL];
@@ -210,8 +241,8 @@ typedef struct _config_t {
     alpm_list_t     *watched;
     alpm_list_t     *watched_aur;
 
-    char            *news_last;
-    alpm_list_t     *news_read;
+    alpm_list_t     *news_feeds;    /* URLs of the news feeds to check */
+    GHashTable      *news_states;   /* feed URL -> news_state_t */
 #ifndef DISABLE_GUI
     char            *cmdline_link;
 #endif
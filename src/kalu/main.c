@@ -59,6 +59,7 @@
 #include "util.h"
 #include "aur.h"
 #include "news.h"
+#include "curl.h"
 
 
 /* global variable */
@@ -87,7 +88,7 @@ const gchar *tpl_sce_names[_NB_TPL_SCE] = {
 
 
 static void notify_updates (alpm_list_t *packages, check_t type,
-        gchar *xml_news, gboolean show_it);
+        news_t *news, gboolean show_it);
 static void free_config (void);
 
 #ifdef DISABLE_GUI
@@ -186,7 +187,7 @@ static void
 notify_updates (
         alpm_list_t *packages,
         check_t      type,
-        gchar       *xml_news,
+        news_t      *news,
         gboolean     show_it
         )
 {
@@ -214,7 +215,7 @@ notify_updates (
     GString         *string_pkgs = NULL;     /* list of AUR packages */
 
 #ifdef DISABLE_GUI
-    (void) xml_news;
+    (void) news;
     (void) show_it;
 #else
     escaping = !is_cli;
@@ -450,7 +451,7 @@ notify_updates (
     }
     else if (type & CHECK_NEWS)
     {
-        notif->data = xml_news;
+        notif->data = news_ref (news);
     }
     else if (!(type & _CHECK_AUR_NOT_FOUND))
     {
@@ -476,7 +477,9 @@ kalu_check_work (gboolean is_auto)
     GError      *error = NULL;
     alpm_list_t *packages;
     alpm_list_t *aur_pkgs;
-    gchar       *xml_news;
+    aur_results_t *aur_results      = NULL;
+    GError      *aur_error          = NULL;
+    news_t      *news;
     gboolean     got_something      = FALSE;
 #ifndef DISABLE_GUI
     gint         nb_upgrades        = -1;
@@ -497,21 +500,25 @@ kalu_check_work (gboolean is_auto)
     FREE_NOTIFS_LIST (config->last_notifs);
 #endif
 
-    /* we will not free packages nor xml_news, because they'll be stored in
-     * notif_t (inside config->last_notifs) so we can re-show notifications.
-     * Everything gets free-d through the FREE_NOTIFS_LIST above */
+    /* we will not free packages, because they'll be stored in notif_t (inside
+     * config->last_notifs) so we can re-show notifications. Everything gets
+     * free-d through the FREE_NOTIFS_LIST above. (news are ref-counted) */
 
     if (checks & CHECK_NEWS)
     {
+        alpm_list_t *feed_errors = NULL;
+        alpm_list_t *i;
+
         packages = NULL;
-        if (news_has_updates (&packages, &xml_news, &error))
+        if (news_has_updates (&packages, &news, &feed_errors, &error))
         {
             got_something = TRUE;
 #ifndef DISABLE_GUI
             nb_news = (gint) alpm_list_count (packages);
 #endif /* DISABLE_GUI */
-            notify_updates (packages, CHECK_NEWS, xml_news, show_it);
+            notify_updates (packages, CHECK_NEWS, news, show_it);
             FREELIST (packages);
+            news_unref (news);
         }
         else if (error != NULL)
         {
@@ -519,10 +526,20 @@ kalu_check_work (gboolean is_auto)
             g_clear_error (&error);
         }
 #ifndef DISABLE_GUI
-        else
+        else if (!feed_errors)
         {
             nb_news = 0;
         }
+#endif /* DISABLE_GUI */
+        /* news from other feeds were still checked */
+        FOR_LIST (i, feed_errors)
+        {
+            do_notify_error (_("Unable to check a news feed"),
+                    ((GError *) i->data)->message);
+            g_error_free (i->data);
+        }
+        alpm_list_free (feed_errors);
+#ifndef DISABLE_GUI
         if (nb_news >= 0)
         {
             set_kalpm_nb (CHECK_NEWS, nb_news, FALSE);
@@ -582,7 +599,10 @@ kalu_check_work (gboolean is_auto)
         if (checks & CHECK_UPGRADES)
         {
             packages = NULL;
-            if (kalu_alpm_has_updates (&packages, &error))
+            /* auto-checks only go by versions, the full thing (incl.
+             * conflicts) is done on manual checks & by the updater */
+            if (kalu_alpm_has_updates (&packages,
+                        is_auto && !config->full_auto_checks, &error))
             {
                 got_something = TRUE;
 #ifndef DISABLE_GUI
@@ -701,8 +721,19 @@ kalu_check_work (gboolean is_auto)
             {
                 alpm_list_t *not_found = NULL;
 
+                /* watched AUR packages are queried at the same time, so
+                 * each package is only looked up once */
+                aur_results = aur_query (aur_pkgs,
+                        (checks & CHECK_WATCHED_AUR) ? config->watched_aur : NULL,
+                        is_auto, &error);
+                if (!aur_results && error && (checks & CHECK_WATCHED_AUR))
+                {
+                    aur_error = g_error_copy (error);
+                }
+
                 packages = NULL;
-                if (aur_has_updates (&packages, &not_found, aur_pkgs, FALSE, &error))
+                if (aur_results && aur_has_updates (&packages, &not_found,
+                            aur_pkgs, FALSE, aur_results))
                 {
                     got_something = TRUE;
 #ifndef DISABLE_GUI
@@ -775,13 +806,25 @@ kalu_check_work (gboolean is_auto)
 #endif
         }
 
-        kalu_alpm_free ();
+        kalu_alpm_done ();
     }
 
     if (checks & CHECK_WATCHED_AUR && config->watched_aur /* NULL if not watched aur pkgs */)
     {
+        /* no need to query again if it was done along with CHECK_AUR */
+        if (aur_error)
+        {
+            error = aur_error;
+            aur_error = NULL;
+        }
+        else if (!aur_results)
+        {
+            aur_results = aur_query (NULL, config->watched_aur, is_auto, &error);
+        }
+
         packages = NULL;
-        if (aur_has_updates (&packages, NULL, config->watched_aur, TRUE, &error))
+        if (aur_results && aur_has_updates (&packages, NULL,
+                    config->watched_aur, TRUE, aur_results))
         {
             got_something = TRUE;
 #ifndef DISABLE_GUI
@@ -812,12 +855,26 @@ kalu_check_work (gboolean is_auto)
             }
 #endif
     }
+    if (aur_results)
+    {
+        aur_free_results (aur_results);
+    }
+    g_clear_error (&aur_error);
 
     if (!is_auto && !got_something)
     {
         do_notify_error (_("No upgrades available."), NULL);
     }
 
+    if (config->is_debug && config->is_curl_init)
+    {
+        curl_stats_t stats;
+
+        curl_pool_get_stats (&stats);
+        debug ("downloads: %u transfers, %u connections opened, %u re-used",
+                stats.nb_transfers, stats.nb_connects, stats.nb_reused);
+    }
+
 #ifndef DISABLE_GUI
     if (is_cli)
     {
@@ -834,6 +891,48 @@ kalu_check_work (gboolean is_auto)
 #endif
 }
 
+static void
+print_net_stats (void)
+{
+    curl_metrics_t *metrics;
+    curl_stats_t stats;
+    guint nb, i;
+
+    if (!config->is_curl_init)
+    {
+        return;
+    }
+
+    curl_pool_get_stats (&stats);
+    metrics = curl_pool_get_metrics (&nb);
+
+    printf (_("Downloads: %u transfers, %u connections opened, %u re-used\n"),
+            stats.nb_transfers, stats.nb_connects, stats.nb_reused);
+    if (nb > 0)
+    {
+        printf ("%-6s %8s %8s %8s %8s %8s %10s %6s  %s\n",
+                _("Result"), _("DNS"), _("Connect"), _("TLS"), _("1st byte"),
+                _("Total"), _("Bytes"), _("Reused"), _("URL"));
+    }
+    for (i = 0; i < nb; ++i)
+    {
+        curl_metrics_t *m = &metrics[i];
+
+        printf ("%-6s %8.3f %8.3f %8.3f %8.3f %8.3f %10" G_GUINT64_FORMAT " %6s  %s\n",
+                (m->is_success) ? _("OK") : _("Failed"),
+                (double) m->namelookup / G_USEC_PER_SEC,
+                (double) m->connect / G_USEC_PER_SEC,
+                (double) m->appconnect / G_USEC_PER_SEC,
+                (double) m->starttransfer / G_USEC_PER_SEC,
+                (double) m->total / G_USEC_PER_SEC,
+                m->bytes,
+                (m->is_reused) ? _("yes") : _("no"),
+                m->url);
+    }
+
+    curl_pool_free_metrics (metrics, nb);
+}
+
 static void
 free_config (void)
 {
@@ -865,8 +964,11 @@ free_config (void)
 #endif
 
     /* news */
-    free (config->news_last);
-    FREELIST (config->news_read);
+    FREELIST (config->news_feeds);
+    if (config->news_states)
+    {
+        g_hash_table_unref (config->news_states);
+    }
 
     free (config);
 }
@@ -1263,6 +1365,7 @@ main (int argc, char *argv[])
     gboolean         run_auto_checks    = FALSE;
     gchar           *tmp_dbpath         = NULL;
     gboolean         keep_tmp_dbpath    = FALSE;
+    gboolean         show_net_stats     = FALSE;
     GOptionEntry     options[] = {
         { "auto-checks",    'a', 0, G_OPTION_ARG_NONE, &run_auto_checks,
             N_("Run automatic checks"), NULL },
@@ -1272,6 +1375,8 @@ main (int argc, char *argv[])
             N_("Use PATH as temporary dbpath"), "PATH" },
         { "keep-tmp-dbpath",'K', 0, G_OPTION_ARG_NONE, &keep_tmp_dbpath,
             N_("Keep tmp dbpath folder"), NULL },
+        { "net-stats",      'N', 0, G_OPTION_ARG_NONE, &show_net_stats,
+            N_("Show network statistics after checks"), NULL },
         { "debug",          'd', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
             opt_debug, N_("Enable debug mode"), NULL },
         { "version",        'V', 0, G_OPTION_ARG_NONE, &show_version,
@@ -1334,6 +1439,15 @@ main (int argc, char *argv[])
         | CHECK_WATCHED_AUR | CHECK_NEWS;
     config->auto_notifs = TRUE;
     config->notif_buttons = TRUE;
+    config->aur_parallel = DEFAULT_AUR_PARALLEL;
+    config->aur_cache_ttl = DEFAULT_AUR_CACHE_TTL * 60;
+    config->aur_backend = AUR_BACKEND_AUTO;
+    config->aur_archive_threshold = DEFAULT_AUR_ARCHIVE_THRESHOLD;
+    config->connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+    config->stall_timeout = DEFAULT_STALL_TIMEOUT;
+    config->download_timeout = DEFAULT_DOWNLOAD_TIMEOUT;
+    config->download_retries = DEFAULT_DOWNLOAD_RETRIES;
+    config->syncdbs_parallel = DEFAULT_SYNCDBS_PARALLEL;
 #ifndef DISABLE_UPDATER
     config->action = UPGRADE_ACTION_KALU;
     config->confirm_post = TRUE;
@@ -1414,6 +1528,10 @@ main (int argc, char *argv[])
                 error->message, NULL);
         g_clear_error (&error);
     }
+    if (!config->news_feeds)
+    {
+        config->news_feeds = alpm_list_add (NULL, strdup (NEWS_RSS_URL));
+    }
     /* parse watched */
     snprintf (conffile, PATH_MAX - 1, "%s/kalu/watched.conf",
             g_get_user_config_dir ());
@@ -1445,6 +1563,10 @@ main (int argc, char *argv[])
     if (curl_global_init (CURL_GLOBAL_ALL) == 0)
     {
         config->is_curl_init = TRUE;
+        if (!curl_pool_init ())
+        {
+            debug ("unable to init cURL share, connections won't be shared");
+        }
     }
     else
     {
@@ -1459,6 +1581,10 @@ main (int argc, char *argv[])
     {
 #endif
         kalu_check_work (run_auto_checks);
+        if (show_net_stats)
+        {
+            print_net_stats ();
+        }
 #ifndef DISABLE_GUI
         goto eop;
     }
@@ -1624,9 +1750,11 @@ eop:
         g_object_unref (sn);
 #endif
 #endif /* DISABLE_GUI */
+    kalu_alpm_free ();
     kalu_alpm_rmdb (keep_tmp_dbpath);
     if (config->is_curl_init)
     {
+        curl_pool_cleanup ();
         curl_global_cleanup ();
     }
     free_config ();
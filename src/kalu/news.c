@@ -51,15 +51,61 @@ enum {
     NB_LISTS
 };
 
-typedef struct _parse_updates_data_t {
-    gboolean     is_last_reached;
-    alpm_list_t *titles;
-} parse_updates_data_t;
+typedef struct _news_item_t {
+    char        *title;
+    char        *description;   /* HTML, as in the feed; NULL if none */
+} news_item_t;
+
+/* a feed, as parsed */
+typedef struct _news_feed_t {
+    gint         ref;
+    char        *url;
+    alpm_list_t *items;         /* news_item_t, as in the feed (newest first) */
+    gboolean     is_complete;   /* FALSE if parsing stopped at the last item
+                                 * from last check */
+} news_feed_t;
+
+/* the feeds, as parsed. It is shared (ref-counted) between the check, its
+ * notification & the news window, so they're only downloaded & parsed once */
+struct _news_t {
+    gint         ref;
+    alpm_list_t *feeds;         /* news_feed_t, as in config->news_feeds */
+};
+
+/* a feed being downloaded & parsed */
+typedef struct _parse_data_t {
+    news_feed_t         *feed;
+    char                *last;  /* title of the last item from last check */
+    gboolean             stop_at_last;
+    gboolean             is_last_reached;
+    const char          *desc_tag;  /* where description of last item is from */
+    GMarkupParseContext *context;
+    curl_request_t       request;
+    char                 cache_name[64];
+} parse_data_t;
+
+typedef void (*GMP_text_fn) (GMarkupParseContext *context,
+                             const gchar         *text,
+                             gsize                text_len,
+                             gpointer             user_data,
+                             GError             **error);
+
+/* name of the cached copy of the Arch news feed (in our cache folder); Other
+ * feeds are cached as news-HASH.xml */
+#define NEWS_CACHE          "news.xml"
+
+/* error code used to stop parsing once the last item from last check was
+ * reached, since there's no need to go any further */
+#define NEWS_LAST_REACHED   100
+
+/* parsed feeds from the last check (or news window); each is re-used as long
+ * as it isn't modified */
+static news_t *last_news = NULL;
+static GMutex last_news_lock;
 
 #ifndef DISABLE_GUI
 
 #define HTML_MAN_PAGE       DOCDIR "/html/index.html"
-#define HISTORY             DOCDIR "/HISTORY"
 
 typedef struct _parse_news_data_t {
     gboolean         only_updates;
@@ -67,26 +113,28 @@ typedef struct _parse_news_data_t {
     GtkTextBuffer   *buffer;
     PangoAttrList   *attr_list;
 
-    gboolean         is_last_reached;
     alpm_list_t    **lists;
 } parse_news_data_t;
 
-typedef void (*GMP_text_fn) (GMarkupParseContext *context,
-                             const gchar         *text,
-                             gsize                text_len,
-                             gpointer             user_data,
-                             GError             **error);
-
-static void
-create_tags (GtkTextBuffer *buffer);
-
-static void
-xml_parser_news_text (GMarkupParseContext *context,
-                      const gchar         *text,
-                      gsize                text_len,
-                      parse_news_data_t   *parse_news_data,
-                      GError             **error _UNUSED_);
-
+/* number of items added to the news window in one go; when showing all news,
+ * only the first batch is added right away, the rest then being added when
+ * idle, so the window shows up as fast no matter how many news there are */
+#define NEWS_BATCH          5
+
+typedef struct _render_news_t {
+    parse_news_data_t    data;
+    GtkWidget           *window;
+    news_t              *news;
+    alpm_list_t         *feed;  /* feed of the next item */
+    alpm_list_t         *next;  /* next item to add */
+} render_news_t;
+
+/* an item of the window of unread news, to be marked read (or not). All in one
+ * block, so it can simply be free-d */
+typedef struct _news_title_t {
+    char        *url;           /* of its feed */
+    char        *title;
+} news_title_t;
 
 /* TRUE when hovering over a link */
 static gboolean hovering_link = FALSE;
@@ -96,179 +144,503 @@ static GdkCursor *cursor_link = NULL;
 /* nb of windows open */
 static gint nb_windows = 0;
 
+#endif /* DISABLE_GUI */
 
 static void
-xml_parser_updates_text (GMarkupParseContext   *context,
-                         const gchar           *text,
-                         gsize                  text_len _UNUSED_,
-                         parse_updates_data_t  *parse_updates_data,
-                         GError               **error _UNUSED_)
+free_state (news_state_t *state)
+{
+    free (state->last);
+    g_hash_table_unref (state->read);
+    free (state);
+}
+
+/* returns the state of feed url from states, adding it (and creating states)
+ * if needed */
+news_state_t *
+news_add_state (GHashTable **states, const char *url)
+{
+    news_state_t *state;
+
+    if (!*states)
+    {
+        *states = g_hash_table_new_full (g_str_hash, g_str_equal, free,
+                (GDestroyNotify) free_state);
+    }
+    state = g_hash_table_lookup (*states, url);
+    if (!state)
+    {
+        state = new0 (news_state_t, 1);
+        state->read = g_hash_table_new_full (g_str_hash, g_str_equal, free, NULL);
+        g_hash_table_insert (*states, strdup (url), state);
+    }
+    return state;
+}
+
+static news_state_t *
+get_state (const char *url)
+{
+    return (config->news_states)
+        ? g_hash_table_lookup (config->news_states, url) : NULL;
+}
+
+/* title of the last item from last check for feed url, or NULL */
+static const char *
+get_news_last (const char *url)
+{
+    news_state_t *state = get_state (url);
+
+    return (state) ? state->last : NULL;
+}
+
+/* whether the item titled title (from feed url) was marked read */
+static gboolean
+is_news_read (const char *url, const char *title)
 {
-    const GSList         *list;
-    alpm_list_t          *i;
+    news_state_t *state = get_state (url);
 
-    /* have we already reached the last unread item */
-    if (parse_updates_data->is_last_reached)
+    return state && g_hash_table_contains (state->read, title);
+}
+
+/* whether feed goes (at least) up to the last item from last check, i.e. has
+ * all the unread news */
+static gboolean
+has_all_unread (news_feed_t *feed)
+{
+    const char *last;
+    alpm_list_t *i;
+
+    if (feed->is_complete)
+    {
+        return TRUE;
+    }
+    last = get_news_last (feed->url);
+    if (last == NULL)
+    {
+        return FALSE;
+    }
+
+    FOR_LIST (i, feed->items)
+    {
+        if (streq (((news_item_t *) i->data)->title, last))
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static news_feed_t *
+new_feed (const char *url)
+{
+    news_feed_t *feed;
+
+    feed = new0 (news_feed_t, 1);
+    feed->ref = 1;
+    feed->url = strdup (url);
+    return feed;
+}
+
+static news_feed_t *
+feed_ref (news_feed_t *feed)
+{
+    g_atomic_int_inc (&feed->ref);
+    return feed;
+}
+
+static void
+free_item (news_item_t *item)
+{
+    free (item->title);
+    free (item->description);
+    free (item);
+}
+
+static void
+feed_unref (news_feed_t *feed)
+{
+    if (!g_atomic_int_dec_and_test (&feed->ref))
     {
         return;
     }
+    alpm_list_free_inner (feed->items, (alpm_list_fn_free) free_item);
+    alpm_list_free (feed->items);
+    free (feed->url);
+    free (feed);
+}
 
-    /* is this a tag (title, description, ...) inside an item? */
-    list = g_markup_parse_context_get_element_stack (context);
-    if (!list->next || !streq ("item", list->next->data))
+static news_t *
+new_news (void)
+{
+    news_t *news;
+
+    news = new0 (news_t, 1);
+    news->ref = 1;
+    return news;
+}
+
+news_t *
+news_ref (news_t *news)
+{
+    g_atomic_int_inc (&news->ref);
+    return news;
+}
+
+void
+news_unref (news_t *news)
+{
+    if (!g_atomic_int_dec_and_test (&news->ref))
     {
         return;
     }
+    alpm_list_free_inner (news->feeds, (alpm_list_fn_free) feed_unref);
+    alpm_list_free (news->feeds);
+    free (news);
+}
 
-    if (streq ("title", list->data))
+#ifndef DISABLE_GUI
+/* returns a reference to last_news, or NULL */
+static news_t *
+get_last_news (void)
+{
+    news_t *news = NULL;
+
+    g_mutex_lock (&last_news_lock);
+    if (last_news)
     {
-        gchar *s = (gchar *) text;
+        news = news_ref (last_news);
+    }
+    g_mutex_unlock (&last_news_lock);
+    return news;
+}
+#endif
 
-        /* if it needs trimming, let's do it. (If not we use text as-is to avoid
-         * a possibly unneeded call strdup) */
-        if (isspace (*s) || isspace (s[strlen (s) - 1]))
+/* returns a reference to the feed url from last_news, or NULL */
+static news_feed_t *
+get_last_feed (const char *url)
+{
+    news_feed_t *feed = NULL;
+    alpm_list_t *i;
+
+    g_mutex_lock (&last_news_lock);
+    if (last_news)
+    {
+        FOR_LIST (i, last_news->feeds)
         {
-            s = strtrim (strdup (s));
+            if (streq (((news_feed_t *) i->data)->url, url))
+            {
+                feed = feed_ref (i->data);
+                break;
+            }
         }
+    }
+    g_mutex_unlock (&last_news_lock);
+    return feed;
+}
+
+static void
+set_last_news (news_t *news)
+{
+    g_mutex_lock (&last_news_lock);
+    if (last_news)
+    {
+        news_unref (last_news);
+    }
+    last_news = news_ref (news);
+    g_mutex_unlock (&last_news_lock);
+}
+
+static void
+xml_parser_text (GMarkupParseContext *context,
+                 const gchar         *text,
+                 gsize                text_len,
+                 parse_data_t        *parse_data,
+                 GError             **error)
+{
+    news_feed_t     *feed = parse_data->feed;
+    news_item_t     *item;
+    const GSList    *list;
+    const char      *desc_tag;
+
+    /* is this a tag (title, description, ...) inside an item (RSS) or entry
+     * (Atom)? */
+    list = g_markup_parse_context_get_element_stack (context);
+    if (!list->next || (!streq ("item", list->next->data)
+                && !streq ("entry", list->next->data)))
+    {
+        return;
+    }
+
+    if (streq ("title", list->data))
+    {
+        item = new0 (news_item_t, 1);
+        item->title = strtrim (strdup (text));
+        feed->items = alpm_list_add (feed->items, item);
+        parse_data->desc_tag = NULL;
 
         /* is this the last item from last check? */
-        if (NULL != config->news_last && streq (config->news_last, s))
+        if (parse_data->stop_at_last && NULL != parse_data->last
+                && streq (parse_data->last, item->title))
         {
-            parse_updates_data->is_last_reached = TRUE;
-            if (s != text)
-            {
-                free (s);
-            }
-            return;
+            parse_data->is_last_reached = TRUE;
+            g_set_error (error, KALU_ERROR, NEWS_LAST_REACHED,
+                    "Last item reached");
         }
+    }
+    else if (feed->items
+            && (desc_tag = (streq ("description", list->data)) ? "description"
+                : (streq ("content", list->data)) ? "content"
+                : (streq ("summary", list->data)) ? "summary" : NULL))
+    {
+        size_t len = 0;
 
-        /* was this item already read? */
-        FOR_LIST (i, config->news_read)
+        /* description of the item whose title was last seen; it might come in
+         * more than one go, e.g. with CDATA sections */
+        item = alpm_list_last (feed->items)->data;
+        /* Atom entries can have both content & summary, the former is used */
+        if (parse_data->desc_tag && !streq (parse_data->desc_tag, desc_tag))
         {
-            if (streq (i->data, s))
+            if (!streq (desc_tag, "content"))
             {
-                if (s != text)
-                {
-                    free (s);
-                }
                 return;
             }
+            free (item->description);
+            item->description = NULL;
         }
-
-        /* add title to the new news */
-        if (s == text)
+        parse_data->desc_tag = desc_tag;
+        if (item->description)
         {
-            s = strdup (s);
+            len = strlen (item->description);
         }
-        parse_updates_data->titles = alpm_list_add (parse_updates_data->titles, s);
+        item->description = renew (char, len + text_len + 1, item->description);
+        memcpy (item->description + len, text, text_len);
+        item->description[len + text_len] = '\0';
     }
 }
 
-#endif /* DISABLE_GUI */
+static GMarkupParseContext *
+new_parse_context (parse_data_t *data)
+{
+    GMarkupParser parser;
+
+    zero (parser);
+    parser.text = (GMP_text_fn) xml_parser_text;
+    return g_markup_parse_context_new (&parser, G_MARKUP_TREAT_CDATA_AS_TEXT,
+            data, NULL);
+}
 
+/* curl_sink_fn, to parse the feed while it's being downloaded. Returns FALSE
+ * without error once the last item from last check was reached, as the rest of
+ * the feed isn't needed (and the context mustn't be used anymore) */
 static gboolean
-parse_xml (gchar *xml, gboolean for_updates, gpointer data_out, GError **error)
+parse_chunk (const char *chunk, size_t len, parse_data_t *data, GError **error)
 {
-    GMarkupParseContext *context;
-    GMarkupParser        parser;
-    GError              *local_err = NULL;
+    GError *local_err = NULL;
 
-    zero (parser);
-    if (for_updates)
+    if (!g_markup_parse_context_parse (data->context, chunk, (gssize) len,
+                &local_err))
     {
-#ifndef DISABLE_GUI
-        parser.text = (GMP_text_fn) xml_parser_updates_text;
-#endif
+        if (g_error_matches (local_err, KALU_ERROR, NEWS_LAST_REACHED))
+        {
+            g_clear_error (&local_err);
+        }
+        else
+        {
+            g_propagate_error (error, local_err);
+        }
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void
+get_cache_name (const char *url, char *name, size_t len)
+{
+    if (streq (url, NEWS_RSS_URL))
+    {
+        snprintf (name, len, "%s", NEWS_CACHE);
     }
     else
     {
-#ifdef DISABLE_GUI
-        return FALSE;
-#else
-        parse_news_data_t   *data;
-        GtkTextBuffer       *buffer;
+        gchar *sum;
+
+        sum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, url, -1);
+        snprintf (name, len, "news-%s.xml", sum);
+        g_free (sum);
+    }
+}
 
-        parser.text = (GMP_text_fn) xml_parser_news_text;
-        data = data_out;
-        buffer = data->buffer;
+/* curl_multi_cb, once a feed was downloaded (and parsed, unless it wasn't
+ * modified, content then being the cached feed). A feed that can't be parsed
+ * fails on its own, like one that couldn't be downloaded */
+static gboolean
+feed_downloaded (curl_request_t    *request,
+                 char              *content,
+                 gpointer           data _UNUSED_,
+                 GError           **error _UNUSED_)
+{
+    parse_data_t *parse_data = request->sink_data;
+    GError *local_err = NULL;
 
-        create_tags (buffer);
+    if (!request->is_modified)
+    {
+        news_feed_t *last;
 
-        if (data->only_updates)
+        last = get_last_feed (parse_data->feed->url);
+        if (last && ((parse_data->stop_at_last)
+                    ? has_all_unread (last) : last->is_complete))
         {
-            /* create a attribute list, for labels of check-titles */
-            PangoAttribute *attr;
-
-            data->attr_list = pango_attr_list_new ();
-            attr = pango_attr_weight_new (800);
-            pango_attr_list_insert (data->attr_list, attr);
-            attr = pango_attr_size_new (10 * PANGO_SCALE);
-            pango_attr_list_insert (data->attr_list, attr);
-            attr = pango_attr_foreground_new (0, 30583, 48059);
-            pango_attr_list_insert (data->attr_list, attr);
+            debug ("news feed %s not modified, re-using last results",
+                    parse_data->feed->url);
+            feed_unref (parse_data->feed);
+            parse_data->feed = last;
+            return TRUE;
+        }
+        if (last)
+        {
+            feed_unref (last);
         }
-#endif
 
+        /* nothing was parsed yet: parse the cached feed */
+        parse_chunk (content, strlen (content), parse_data, &local_err);
     }
-    context = g_markup_parse_context_new (&parser, G_MARKUP_TREAT_CDATA_AS_TEXT,
-            data_out, NULL);
 
-    if (!g_markup_parse_context_parse (context,
-                xml,
-                (gssize) strlen (xml),
-                &local_err))
+    /* parsing stopped at the last item from last check, if it was found */
+    if (!local_err && !parse_data->is_last_reached
+            && g_markup_parse_context_end_parse (parse_data->context, &local_err))
     {
-        g_markup_parse_context_free (context);
-#ifndef DISABLE_GUI
-        if (!for_updates && ((parse_news_data_t *)data_out)->only_updates)
+        parse_data->feed->is_complete = TRUE;
+    }
+    if (local_err)
+    {
+        debug ("parsing news feed %s failed: %s", parse_data->feed->url,
+                local_err->message);
+        g_propagate_error (&request->error, local_err);
+    }
+    return TRUE;
+}
+
+/* downloads all feeds at once, each being parsed as it arrives; With
+ * stop_at_last, parsing of a feed stops at its last item from last check.
+ * A feed failing doesn't fail the others: news only has those that succeeded,
+ * and an error for each one that didn't is added to feed_errors */
+static news_t *
+fetch_news (gboolean stop_at_last, alpm_list_t **feed_errors, GError **error)
+{
+    GError       *local_err = NULL;
+    parse_data_t *feeds;
+    alpm_list_t  *requests = NULL;
+    alpm_list_t  *i;
+    news_t       *news = NULL;
+    guint         nb, n;
+
+    nb = (guint) alpm_list_count (config->news_feeds);
+    feeds = new0 (parse_data_t, nb);
+    for (i = config->news_feeds, n = 0; i; i = alpm_list_next (i), ++n)
+    {
+        parse_data_t *data = &feeds[n];
+        const char *last = get_news_last (i->data);
+
+        data->feed = new_feed (i->data);
+        data->last = (last) ? strdup (last) : NULL;
+        data->stop_at_last = stop_at_last;
+        data->context = new_parse_context (data);
+        get_cache_name (data->feed->url, data->cache_name,
+                sizeof (data->cache_name));
+        data->request.url = data->feed->url;
+        data->request.sink_fn = (curl_sink_fn) parse_chunk;
+        data->request.sink_data = data;
+        data->request.cache_name = data->cache_name;
+        data->request.may_fail = TRUE;
+        requests = alpm_list_add (requests, &data->request);
+    }
+
+    /* all at once, so more feeds don't make for a longer check */
+    if (curl_download_multi (requests, nb, feed_downloaded, NULL, &local_err))
+    {
+        news = new_news ();
+        for (n = 0; n < nb; ++n)
         {
-            pango_attr_list_unref (((parse_news_data_t *)data_out)->attr_list);
+            GError *feed_err = feeds[n].request.error;
+
+            if (feed_err)
+            {
+                GError *err = NULL;
+
+                g_set_error (&err, KALU_ERROR, 1, "%s: %s",
+                        feeds[n].feed->url, feed_err->message);
+                *feed_errors = alpm_list_add (*feed_errors, err);
+                continue;
+            }
+            news->feeds = alpm_list_add (news->feeds, feed_ref (feeds[n].feed));
         }
-#endif
+        set_last_news (news);
+    }
+    else
+    {
         g_propagate_error (error, local_err);
-        return FALSE;
     }
-    g_markup_parse_context_free (context);
-#ifndef DISABLE_GUI
-    if (!for_updates && ((parse_news_data_t *)data_out)->only_updates)
+
+    for (n = 0; n < nb; ++n)
     {
-        pango_attr_list_unref (((parse_news_data_t *)data_out)->attr_list);
+        if (feeds[n].request.error)
+        {
+            g_error_free (feeds[n].request.error);
+        }
+        g_markup_parse_context_free (feeds[n].context);
+        feed_unref (feeds[n].feed);
+        free (feeds[n].last);
     }
-#endif
-    return TRUE;
+    alpm_list_free (requests);
+    free (feeds);
+    return news;
 }
 
 gboolean
 news_has_updates (alpm_list_t **titles,
-                  gchar       **xml_news,
+                  news_t      **news,
+                  alpm_list_t **feed_errors,
                   GError      **error)
 {
-    GError               *local_err = NULL;
-    parse_updates_data_t  data;
+    news_t               *parsed;
+    alpm_list_t          *unread = NULL;
+    alpm_list_t          *i, *j;
 
-    *xml_news = curl_download (NEWS_RSS_URL, &local_err);
-    if (local_err != NULL)
+    parsed = fetch_news (TRUE, feed_errors, error);
+    if (!parsed)
     {
-        g_propagate_error (error, local_err);
         return FALSE;
     }
 
-    zero (data);
-    if (!parse_xml (*xml_news, TRUE, (gpointer) &data, &local_err))
+    FOR_LIST (i, parsed->feeds)
     {
-        free (*xml_news);
-        g_propagate_error (error, local_err);
-        return FALSE;
+        news_feed_t *feed = i->data;
+        const char *last = get_news_last (feed->url);
+
+        FOR_LIST (j, feed->items)
+        {
+            news_item_t *item = j->data;
+
+            /* is this the last item from last check? */
+            if (NULL != last && streq (last, item->title))
+            {
+                break;
+            }
+            if (!is_news_read (feed->url, item->title))
+            {
+                unread = alpm_list_add (unread, strdup (item->title));
+            }
+        }
     }
 
-    if (data.titles == NULL)
+    if (unread == NULL)
     {
-        free (*xml_news);
+        news_unref (parsed);
         return FALSE;
     }
     else
     {
-        *titles = data.titles;
+        *titles = unread;
+        *news = parsed;
         return TRUE;
     }
 }
@@ -277,10 +649,31 @@ news_has_updates (alpm_list_t **titles,
 
 #ifndef DISABLE_GUI
 
+static news_title_t *
+new_title (const char *url, const char *title)
+{
+    news_title_t *t;
+    size_t len_url = strlen (url) + 1;
+    size_t len_title = strlen (title) + 1;
+
+    t = (news_title_t *) new (char, sizeof (news_title_t) + len_url + len_title);
+    t->url = (char *) (t + 1);
+    memcpy (t->url, url, len_url);
+    t->title = t->url + len_url;
+    memcpy (t->title, title, len_title);
+    return t;
+}
+
+static int
+ptr_cmp (const void *p1, const void *p2)
+{
+    return p1 != p2;
+}
+
 static void
 title_toggled_cb (GtkToggleButton *button, alpm_list_t **lists)
 {
-    gchar *title = g_object_get_data (G_OBJECT (button), "title");
+    news_title_t *title = g_object_get_data (G_OBJECT (button), "title");
     gboolean is_active;
 
     g_object_get (G_OBJECT (button), "active", &is_active, NULL);
@@ -290,8 +683,8 @@ title_toggled_cb (GtkToggleButton *button, alpm_list_t **lists)
     }
     else
     {
-        lists[LIST_TITLES_READ] = alpm_list_remove_str (lists[LIST_TITLES_READ],
-                title, NULL);
+        lists[LIST_TITLES_READ] = alpm_list_remove (lists[LIST_TITLES_READ],
+                title, (alpm_list_fn_cmp) ptr_cmp, NULL);
     }
 }
 
@@ -673,126 +1066,94 @@ parse_to_buffer (GtkTextBuffer *buffer, const gchar *text, gsize text_len)
 }
 #undef insert_text_with_tags
 
+/* adds item to the window; title is the one stored in lists (when showing only
+ * unread news), to be used for marking it read */
 static void
-xml_parser_news_text (GMarkupParseContext *context,
-                      const gchar         *text,
-                      gsize                text_len,
-                      parse_news_data_t   *parse_news_data,
-                      GError             **error _UNUSED_)
+add_news_item (parse_news_data_t *parse_news_data, news_item_t *item,
+               news_title_t *title)
 {
     GtkTextBuffer   *buffer = parse_news_data->buffer;
     GtkTextIter     iter;
-    gchar           *s = NULL;
-    const GSList    *list;
-    alpm_list_t     *i;
-    gboolean        is_title = FALSE;
-    static gboolean skip_next_description = FALSE;
-    alpm_list_t   **lists = NULL;
-
-    /* have we already reached the last unread item */
-    if (parse_news_data->only_updates && parse_news_data->is_last_reached)
-    {
-        return;
-    }
+    alpm_list_t   **lists = parse_news_data->lists;
 
-    /* is this a tag (title, description, ...) inside an item? */
-    list = g_markup_parse_context_get_element_stack (context);
-    if (!list->next || !streq ("item", list->next->data))
-    {
-        return;
-    }
+    /* add a LF */
+    gtk_text_buffer_get_end_iter (buffer, &iter);
+    gtk_text_buffer_insert (buffer, &iter, "\n", -1);
 
-    /* gather whether this is title or description, don't go any further if it's
-     * anything else*/
-    if (streq ("title", list->data))
+    if (parse_news_data->only_updates && lists)
     {
-        is_title = TRUE;
+        GtkTextChildAnchor *anchor;
+        GtkWidget *check, *label;
+
+        /* store title in list of shown titles */
+        lists[LIST_TITLES_SHOWN] = alpm_list_add (lists[LIST_TITLES_SHOWN], title);
+
+        /* add a widget to check if the news should be marked read */
+        anchor = gtk_text_buffer_create_child_anchor(buffer, &iter);
+        check = gtk_check_button_new ();
+        /* we set as data the title, same as in the lists above. it will be
+         * used on toggled callback to be added to/removed from
+         * lists[LIST_TITLES_READ] */
+        g_object_set_data (G_OBJECT (check), "title", title);
+        g_signal_connect (G_OBJECT (check), "toggled",
+                G_CALLBACK (title_toggled_cb), lists);
+        gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (check), TRUE);
+        gtk_widget_show (check);
+        label = gtk_label_new (item->title);
+        gtk_label_set_attributes (GTK_LABEL (label),
+                parse_news_data->attr_list);
+        gtk_container_add (GTK_CONTAINER (check), label);
+        gtk_widget_show (label);
+        gtk_text_view_add_child_at_anchor (parse_news_data->textview,
+                check,
+                anchor);
     }
-    else if (!streq ("description", list->data))
+    else
     {
-        return;
+        gtk_text_buffer_insert_with_tags_by_name (buffer, &iter,
+                item->title, -1, "title", NULL);
     }
+    gtk_text_buffer_insert (buffer, &iter, "\n", -1);
 
-    if (parse_news_data->only_updates)
+    if (item->description)
     {
-        if (is_title)
-        {
-            /* make a copy of the title, and store it in list of all titles */
-            /* it will not be free-d here. this is done on window_destroy_cb */
-            s = strtrim (strdup (text));
-            lists = parse_news_data->lists;
-            lists[LIST_TITLES_ALL] = alpm_list_add (lists[LIST_TITLES_ALL], s);
-
-            /* is this the last item from last check? */
-            if (NULL != config->news_last && streq (config->news_last, s))
-            {
-                parse_news_data->is_last_reached = TRUE;
-                return;
-            }
-
-            /* was this item already read? */
-            FOR_LIST (i, config->news_read)
-            {
-                if (streq (i->data, s))
-                {
-                    /* make a note to skip its description as well */
-                    skip_next_description = TRUE;
-                    return;
-                }
-            }
-        }
-        else if (skip_next_description)
-        {
-            skip_next_description = FALSE;
-            return;
-        }
+        parse_to_buffer (buffer, item->description, strlen (item->description));
     }
+}
 
-    if (is_title)
+/* makes sure next is the next item to add, moving on to the next feed(s) if
+ * needed */
+static void
+find_next_item (render_news_t *render)
+{
+    while (!render->next && render->feed
+            && (render->feed = alpm_list_next (render->feed)))
     {
-        /* add a LF */
-        gtk_text_buffer_get_end_iter (buffer, &iter);
-        gtk_text_buffer_insert (buffer, &iter, "\n", -1);
-
-        if (parse_news_data->only_updates && lists)
-        {
-            GtkTextChildAnchor *anchor;
-            GtkWidget *check, *label;
+        render->next = ((news_feed_t *) render->feed->data)->items;
+    }
+}
 
-            /* store title in list of shown titles */
-            lists[LIST_TITLES_SHOWN] = alpm_list_add (lists[LIST_TITLES_SHOWN], s);
+/* adds the next batch of news to the window */
+static gboolean
+render_news_batch (render_news_t *render)
+{
+    int n;
 
-            /* add a widget to check if the news should be marked read */
-            anchor = gtk_text_buffer_create_child_anchor(buffer, &iter);
-            check = gtk_check_button_new ();
-            /* we set as data the title, same as in the lists above. it will be
-             * used on toggled callback to be added to/removed from
-             * lists[LIST_TITLES_READ] */
-            g_object_set_data (G_OBJECT (check), "title", s);
-            g_signal_connect (G_OBJECT (check), "toggled",
-                    G_CALLBACK (title_toggled_cb), lists);
-            gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (check), TRUE);
-            gtk_widget_show (check);
-            label = gtk_label_new (text);
-            gtk_label_set_attributes (GTK_LABEL (label),
-                    parse_news_data->attr_list);
-            gtk_container_add (GTK_CONTAINER (check), label);
-            gtk_widget_show (label);
-            gtk_text_view_add_child_at_anchor (parse_news_data->textview,
-                    check,
-                    anchor);
-        }
-        else
-        {
-            gtk_text_buffer_insert_with_tags_by_name (buffer, &iter,
-                    text, -1, "title", NULL);
-        }
-        gtk_text_buffer_insert (buffer, &iter, "\n", -1);
-    }
-    else
+    for (n = 0; render->next && n < NEWS_BATCH; ++n)
     {
-        parse_to_buffer (buffer, text, text_len);
+        add_news_item (&render->data, render->next->data, NULL);
+        render->next = alpm_list_next (render->next);
+        find_next_item (render);
     }
+    return (render->next) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static void
+free_render_news (render_news_t *render)
+{
+    g_object_set_data (G_OBJECT (render->window), "render", NULL);
+    news_unref (render->news);
+    free (render);
 }
 
 static void
@@ -839,13 +1200,50 @@ btn_close_cb (GtkWidget *button _UNUSED_, GtkWidget *window)
     gtk_widget_destroy (window);
 }
 
+/* copies state (of feed url) into states */
+static void
+copy_state (GHashTable **states, const char *url, news_state_t *state)
+{
+    news_state_t *copy;
+    GHashTableIter iter;
+    gchar *title;
+
+    copy = news_add_state (states, url);
+    copy->last = (state->last) ? strdup (state->last) : NULL;
+    g_hash_table_iter_init (&iter, state->read);
+    while (g_hash_table_iter_next (&iter, (gpointer) &title, NULL))
+    {
+        g_hash_table_add (copy->read, strdup (title));
+    }
+}
+
+static void
+append_state (GString *str, const char *url, news_state_t *state)
+{
+    GHashTableIter iter;
+    gchar *title;
+
+    /* the Arch feed is the one outside of any section */
+    if (!streq (url, NEWS_RSS_URL))
+    {
+        g_string_append_printf (str, "[%s]\n", url);
+    }
+    if (state->last)
+    {
+        g_string_append_printf (str, "Last=%s\n", state->last);
+    }
+    g_hash_table_iter_init (&iter, state->read);
+    while (g_hash_table_iter_next (&iter, (gpointer) &title, NULL))
+    {
+        g_string_append_printf (str, "Read=%s\n", title);
+    }
+}
+
 static void
 btn_mark_cb (GtkWidget *button _UNUSED_, GtkWidget *window)
 {
-    alpm_list_t **lists, *titles_all, *titles_shown, *titles_read, *i;
-    alpm_list_t *news_read = NULL;
-    char *news_last = NULL;
-    gboolean is_last_set = FALSE;
+    alpm_list_t **lists, *titles_all, *titles_shown, *titles_read, *i, *j;
+    GHashTable *news_states = NULL;
     int nb_unread = 0;
 
     gtk_widget_hide (window);
@@ -856,38 +1254,71 @@ btn_mark_cb (GtkWidget *button _UNUSED_, GtkWidget *window)
     titles_shown = lists[LIST_TITLES_SHOWN];
     titles_read = lists[LIST_TITLES_READ];
 
-    FOR_LIST (i, titles_all)
+    /* only feeds still checked are kept, and for those shown only titles still
+     * in the feed, so it doesn't grow forever */
+    FOR_LIST (i, config->news_feeds)
     {
-        void *shown = alpm_list_find_ptr (titles_shown, i->data);
+        const char *url = i->data;
+        news_state_t *state = NULL;
+        gboolean is_last_set = FALSE;
 
-        /* was this news not shown, or shown and mark read? */
-        if (!shown || (shown && alpm_list_find_ptr (titles_read, i->data)))
+        FOR_LIST (j, titles_all)
         {
-            /* was last already set? */
-            if (is_last_set)
+            news_title_t *t = j->data;
+            void *shown;
+
+            if (!streq (t->url, url))
             {
-                /* then we add it to read */
-                debug ("read:%s", (char*)i->data);
-                news_read = alpm_list_add (news_read, strdup (i->data));
+                continue;
             }
-            else
+            if (!state)
+            {
+                state = news_add_state (&news_states, url);
+            }
+
+            shown = alpm_list_find_ptr (titles_shown, t);
+            /* was this news not shown, or shown and mark read? */
+            if (!shown || (shown && alpm_list_find_ptr (titles_read, t)))
             {
-                /* set the new last */
-                if (news_last)
+                /* was last already set? */
+                if (is_last_set)
                 {
-                    free (news_last);
+                    /* then we add it to read */
+                    debug ("read:%s", t->title);
+                    g_hash_table_add (state->read, strdup (t->title));
+                }
+                else
+                {
+                    /* set the new last */
+                    free (state->last);
+                    debug ("last=%s", t->title);
+                    state->last = strdup (t->title);
                 }
-                debug ("last=%s", (char*)i->data);
-                news_last = strdup (i->data);
+            }
+            /* was it shown? i.e. stays unread */
+            else if (shown)
+            {
+                ++nb_unread;
+                /* item was not read, so we can simply say that now last is
+                 * set. either it has been set/updated before, or it remains
+                 * unchanged */
+                is_last_set = TRUE;
             }
         }
-        /* was it shown? i.e. stays unread */
-        else if (shown)
+
+        if (!state)
         {
-            ++nb_unread;
-            /* item was not read, so we can simply say that now last is set.
-             * either it has been set/updated before, or it remains unchanged */
-            is_last_set = TRUE;
+            /* not in the window, keep it as is */
+            state = get_state (url);
+            if (state)
+            {
+                copy_state (&news_states, url, state);
+            }
+        }
+        /* no news marked read at all: last remains unchanged */
+        else if (!state->last && get_news_last (url))
+        {
+            state->last = strdup (get_news_last (url));
         }
     }
 
@@ -895,38 +1326,46 @@ btn_mark_cb (GtkWidget *button _UNUSED_, GtkWidget *window)
      * in titles) will be free-d when destroying the window */
     alpm_list_free (titles_all);
 
-    /* save */
-    FILE *fp;
+    /* save; news.conf is written as a whole (i.e. compacted) into a new file
+     * which then replaces the old one, so it can't end up half-written */
+    GString *str;
+    GHashTableIter iter;
+    news_state_t *state;
+    gchar *url;
     char file[PATH_MAX];
     gboolean saved = FALSE;
 
-    snprintf (file, PATH_MAX - 1, "%s/kalu/news.conf", g_get_user_config_dir ());
-    if (ensure_path (file))
+    str = g_string_sized_new (1024);
+    if (news_states)
     {
-        fp = fopen (file, "w");
-        if (fp != NULL)
+        /* must come first, being outside of any section */
+        state = g_hash_table_lookup (news_states, NEWS_RSS_URL);
+        if (state)
         {
-            fputs ("Last=", fp);
-            fputs (news_last, fp);
-            fputs ("\n", fp);
-
-            FOR_LIST (i, news_read)
+            append_state (str, NEWS_RSS_URL, state);
+        }
+        g_hash_table_iter_init (&iter, news_states);
+        while (g_hash_table_iter_next (&iter, (gpointer) &url, (gpointer) &state))
+        {
+            if (!streq (url, NEWS_RSS_URL))
             {
-                fputs ("Read=", fp);
-                fputs ((const char *) i->data, fp);
-                fputs ("\n", fp);
+                append_state (str, url, state);
             }
-            fclose (fp);
+        }
+    }
 
+    snprintf (file, PATH_MAX - 1, "%s/kalu/news.conf", g_get_user_config_dir ());
+    if (ensure_path (file))
+    {
+        if (g_file_set_contents (file, str->str, (gssize) str->len, NULL))
+        {
             /* update */
-            if (config->news_last)
+            if (config->news_states)
             {
-                free (config->news_last);
+                g_hash_table_unref (config->news_states);
             }
-            config->news_last = news_last;
-
-            FREELIST (config->news_read);
-            config->news_read = news_read;
+            config->news_states = news_states;
+            news_states = NULL;
 
             /* we go and change the last_notifs. if nb_unread = 0 we can
              * simply remove it, else we change it to ask to run the checks again
@@ -945,7 +1384,7 @@ btn_mark_cb (GtkWidget *button _UNUSED_, GtkWidget *window)
                     }
                     else
                     {
-                        free (notif->data);
+                        news_unref (notif->data);
                         notif->data = NULL;
                         free (notif->text);
                         notif->text = strdup (_("Read news have changed, "
@@ -959,6 +1398,12 @@ btn_mark_cb (GtkWidget *button _UNUSED_, GtkWidget *window)
         }
     }
 
+    g_string_free (str, TRUE);
+    if (news_states)
+    {
+        g_hash_table_unref (news_states);
+    }
+
     if (saved)
     {
         gtk_widget_destroy (window);
@@ -975,6 +1420,7 @@ static void
 window_destroy_cb (GtkWidget *window, gpointer data _UNUSED_)
 {
     alpm_list_t **lists;
+    guint render_id;
     int i;
 
     if (--nb_windows == 0)
@@ -983,6 +1429,13 @@ window_destroy_cb (GtkWidget *window, gpointer data _UNUSED_)
         g_object_unref (cursor_std);
     }
 
+    /* stop adding news, if not done yet */
+    render_id = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (window), "render"));
+    if (render_id > 0)
+    {
+        g_source_remove (render_id);
+    }
+
     /* will be present if this was a only_updates window */
     lists = g_object_get_data (G_OBJECT (window), "lists");
     if (lists)
@@ -1280,26 +1733,76 @@ new_window (gboolean only_updates, GtkWidget **window, GtkWidget **textview)
     gtk_widget_show (button);
 }
 
+/* whether news has what's needed, i.e. all unread items, or all items */
+static gboolean
+has_needed (news_t *news, gboolean only_updates)
+{
+    alpm_list_t *i;
+
+    /* some feed(s) failed last time */
+    if (alpm_list_count (news->feeds) != alpm_list_count (config->news_feeds))
+    {
+        return FALSE;
+    }
+
+    FOR_LIST (i, news->feeds)
+    {
+        news_feed_t *feed = i->data;
+
+        if (!((only_updates) ? has_all_unread (feed) : feed->is_complete))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* the news shown are only from the feeds that didn't fail */
+static void
+show_feed_errors (alpm_list_t *feed_errors, GtkWidget *window)
+{
+    alpm_list_t *i;
+
+    FOR_LIST (i, feed_errors)
+    {
+        GError *err = i->data;
+
+        show_error (_("Unable to check a news feed"), err->message,
+                (window) ? GTK_WINDOW (window) : NULL);
+        g_error_free (err);
+    }
+    alpm_list_free (feed_errors);
+}
+
 gboolean
-news_show (gchar *xml_news, gboolean only_updates, GError **error)
+news_show (news_t *news, gboolean only_updates, GError **error)
 {
     GError             *local_err = NULL;
-    gboolean            is_xml_ours = FALSE;
     parse_news_data_t   data;
     GtkWidget          *window;
     GtkWidget          *textview;
+    alpm_list_t        *feed_errors = NULL;
+    alpm_list_t        *i, *j;
+
+    /* if none was provided, use the one from last check if good enough, i.e.
+     * with all news or at least all unread ones, as needed */
+    news = (news) ? news_ref (news) : get_last_news ();
+    if (news && !has_needed (news, only_updates))
+    {
+        news_unref (news);
+        news = NULL;
+    }
 
-    /* if no XML was provided, download it */
-    if (xml_news == NULL)
+    /* else download them */
+    if (news == NULL)
     {
-        xml_news = curl_download (NEWS_RSS_URL, &local_err);
-        if (local_err != NULL)
+        news = fetch_news (only_updates, &feed_errors, &local_err);
+        if (news == NULL)
         {
             g_propagate_error (error, local_err);
             set_kalpm_busy (FALSE);
             return FALSE;
         }
-        is_xml_ours = TRUE;
     }
 
     new_window (only_updates, &window, &textview);
@@ -1310,35 +1813,106 @@ news_show (gchar *xml_news, gboolean only_updates, GError **error)
     data.buffer = gtk_text_view_get_buffer (data.textview);
     data.lists = g_object_get_data (G_OBJECT (window), "lists");
 
-    if (!parse_xml (xml_news, FALSE, (gpointer) &data, &local_err))
+    create_tags (data.buffer);
+    /* all news: add the first ones, the rest will follow when idle */
+    if (!only_updates)
     {
-        if (is_xml_ours)
+        render_news_t *render;
+        guint id;
+
+        render = new0 (render_news_t, 1);
+        render->data = data;
+        render->window = window;
+        render->news = news;
+        render->feed = news->feeds;
+        if (render->feed)
         {
-            free (xml_news);
+            render->next = ((news_feed_t *) render->feed->data)->items;
         }
-        g_propagate_error (error, local_err);
-        gtk_widget_destroy (window);
+        find_next_item (render);
+        if (render_news_batch (render) == G_SOURCE_CONTINUE)
+        {
+            id = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                    (GSourceFunc) render_news_batch, render,
+                    (GDestroyNotify) free_render_news);
+            g_object_set_data (G_OBJECT (window), "render", GUINT_TO_POINTER (id));
+        }
+        else
+        {
+            free_render_news (render);
+        }
+        gtk_widget_show (window);
+        show_feed_errors (feed_errors, window);
         set_kalpm_busy (FALSE);
-        return FALSE;
+        return TRUE;
     }
-    if (is_xml_ours)
+
+    /* create a attribute list, for labels of check-titles */
+    PangoAttribute *attr;
+
+    data.attr_list = pango_attr_list_new ();
+    attr = pango_attr_weight_new (800);
+    pango_attr_list_insert (data.attr_list, attr);
+    attr = pango_attr_size_new (10 * PANGO_SCALE);
+    pango_attr_list_insert (data.attr_list, attr);
+    attr = pango_attr_foreground_new (0, 30583, 48059);
+    pango_attr_list_insert (data.attr_list, attr);
+
+    /* unread news: add them all now, as they're needed to mark them read (and
+     * there usually aren't many) */
+    FOR_LIST (i, news->feeds)
     {
-        free (xml_news);
+        news_feed_t *feed = i->data;
+        const char *last = get_news_last (feed->url);
+
+        FOR_LIST (j, feed->items)
+        {
+            news_item_t *item = j->data;
+            news_title_t *title = NULL;
+
+            if (data.lists)
+            {
+                /* store (a copy of) the title in list of all titles */
+                /* it will not be free-d here. this is done on window_destroy_cb */
+                title = new_title (feed->url, item->title);
+                data.lists[LIST_TITLES_ALL] = alpm_list_add (
+                        data.lists[LIST_TITLES_ALL], title);
+
+                /* is this the last item from last check? */
+                if (NULL != last && streq (last, item->title))
+                {
+                    break;
+                }
+
+                /* was this item already read? */
+                if (is_news_read (feed->url, item->title))
+                {
+                    continue;
+                }
+            }
+
+            add_news_item (&data, item, title);
+        }
     }
 
-    /* if we were only showing updates, but there are none to show (i.e. from
-     * the menu "Show unread news") then just show a notif about it */
-    if (only_updates && data.lists && data.lists[LIST_TITLES_SHOWN] == NULL)
+    pango_attr_list_unref (data.attr_list);
+    news_unref (news);
+
+    /* if there are no unread news to show (i.e. from the menu "Show unread
+     * news") then just show a notif about it */
+    if (data.lists && data.lists[LIST_TITLES_SHOWN] == NULL)
     {
         gtk_widget_destroy (window);
         notify_error (_("No unread news"),
                 _("There are no unread Arch Linux news."));
+        window = NULL;
     }
     else
     {
         gtk_widget_show (window);
     }
 
+    show_feed_errors (feed_errors, window);
     set_kalpm_busy (FALSE);
     return TRUE;
 }
@@ -1378,67 +1952,24 @@ show_help (GError **error)
     return TRUE;
 }
 
+/* HISTORY, already turned into markup at build time */
+extern const char kalu_history[];
+extern size_t kalu_history_size;
+
 gboolean
-show_history (GError **error)
+show_history (GError **error _UNUSED_)
 {
-    GError        *local_err = NULL;
     GtkWidget     *window;
     GtkWidget     *textview;
     GtkTextBuffer *buffer;
-    gchar         *text, *s;
 
     new_window (FALSE, &window, &textview);
     gtk_window_set_title (GTK_WINDOW (window), _("History - kalu"));
     gtk_window_set_default_size (GTK_WINDOW (window), 600, 420);
     buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (textview));
 
-    if (!g_file_get_contents (HISTORY, &text, NULL, &local_err))
-    {
-        g_propagate_error (error, local_err);
-        gtk_widget_destroy (window);
-        return FALSE;
-    }
-
-    /* to preserves '<' */
-    s = strreplace (text, "<", " <lt>");
-    g_free (text);
-    text = s;
-
-    /* to preserves '>' */
-    s = strreplace (text, ">", " <gt>");
-    g_free (text);
-    text = s;
-
-    /* to preserve LF-s */
-    s = strreplace (text, "\n\n", " <br>");
-    g_free (text);
-    text = s;
-
-    /* add empty line before each new line (change) */
-    s = strreplace (text, "<br>-", "<br><br>-");
-    g_free (text);
-    text = s;
-
-    /* to turn date/version number into titles (w/ some styling) */
-    s = strreplace (text, "\n# ", "<br><h2>");
-    g_free (text);
-    text = s;
-    while ((s = strstr (s, "<h2>")))
-    {
-        s = strstr (s, " <br>");
-        if (s)
-        {
-            *(s + 0) = '<';
-            *(s + 1) = '/';
-            *(s + 2) = 'h';
-            *(s + 3) = '2';
-            *(s + 4) = '>';
-        }
-    }
-
     create_tags (buffer);
-    parse_to_buffer (buffer, text, (gsize) strlen (text));
-    g_free (text);
+    parse_to_buffer (buffer, kalu_history, (gsize) kalu_history_size);
     gtk_widget_show (window);
     return TRUE;
 }
@@ -29,13 +29,26 @@
 /* alpm list */
 #include <alpm_list.h>
 
+/* the parsed feeds, shared between a check & its notification */
+typedef struct _news_t news_t;
+
+news_state_t *
+news_add_state (GHashTable **states, const char *url);
+
+news_t *
+news_ref (news_t *news);
+
+void
+news_unref (news_t *news);
+
 gboolean
 news_has_updates (alpm_list_t **titles,
-                  gchar       **xml_news,
+                  news_t      **news,
+                  alpm_list_t **feed_errors,
                   GError      **error);
 
 gboolean
-news_show (gchar *xml_news, gboolean only_updates, GError **error);
+news_show (news_t *news, gboolean only_updates, GError **error);
 
 gboolean
 show_help (GError **error);
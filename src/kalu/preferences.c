@@ -812,6 +812,77 @@ btn_save_cb (GtkButton *button _UNUSED_, gpointer data _UNUSED_)
         add_to_conf ("UseIP = 6\n");
     }
 
+    /* max. concurrent AUR requests (no GUI) */
+    if (new_config.aur_parallel != DEFAULT_AUR_PARALLEL)
+    {
+        add_to_conf ("AurParallel = %d\n", new_config.aur_parallel);
+    }
+
+    /* TTL of AUR cache (no GUI) */
+    if (new_config.aur_cache_ttl != DEFAULT_AUR_CACHE_TTL * 60)
+    {
+        add_to_conf ("AurCacheTTL = %d\n", new_config.aur_cache_ttl / 60);
+    }
+
+    /* backend used for AUR checks (no GUI) */
+    if (new_config.aur_backend == AUR_BACKEND_RPC)
+    {
+        add_to_conf ("AurBackend = rpc\n");
+    }
+    else if (new_config.aur_backend == AUR_BACKEND_ARCHIVE)
+    {
+        add_to_conf ("AurBackend = archive\n");
+    }
+    if (new_config.aur_archive_threshold != DEFAULT_AUR_ARCHIVE_THRESHOLD)
+    {
+        add_to_conf ("AurArchiveThreshold = %d\n",
+                new_config.aur_archive_threshold);
+    }
+
+    /* timeouts & retries for downloads (no GUI) */
+    if (new_config.connect_timeout != DEFAULT_CONNECT_TIMEOUT)
+    {
+        add_to_conf ("ConnectTimeout = %d\n", new_config.connect_timeout);
+    }
+    if (new_config.stall_timeout != DEFAULT_STALL_TIMEOUT)
+    {
+        add_to_conf ("StallTimeout = %d\n", new_config.stall_timeout);
+    }
+    if (new_config.download_timeout != DEFAULT_DOWNLOAD_TIMEOUT)
+    {
+        add_to_conf ("DownloadTimeout = %d\n", new_config.download_timeout);
+    }
+    if (new_config.download_retries != DEFAULT_DOWNLOAD_RETRIES)
+    {
+        add_to_conf ("DownloadRetries = %d\n", new_config.download_retries);
+    }
+
+    /* max. concurrent sync DBs downloads (no GUI) */
+    if (new_config.syncdbs_parallel != DEFAULT_SYNCDBS_PARALLEL)
+    {
+        add_to_conf ("SyncDbsParallel = %d\n", new_config.syncdbs_parallel);
+    }
+
+    /* full transaction on auto-checks (no GUI) */
+    if (new_config.full_auto_checks)
+    {
+        add_to_conf ("FullAutoChecks = 1\n");
+    }
+
+    /* news feeds, if not just the Arch one (no GUI) */
+    if (alpm_list_count (new_config.news_feeds) != 1
+            || !streq (new_config.news_feeds->data, NEWS_RSS_URL))
+    {
+        alpm_list_t *i;
+
+        add_to_conf ("NewsFeeds =");
+        FOR_LIST (i, new_config.news_feeds)
+        {
+            add_to_conf (" %s", (const char *) i->data);
+        }
+        add_to_conf ("\n");
+    }
+
     /* disabling showing notifs for auto-checks (no GUI) */
     if (!new_config.auto_notifs)
     {
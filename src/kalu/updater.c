@@ -2747,7 +2747,7 @@ btn_rerun_cb (GtkButton *button _UNUSED_, gpointer data _UNUSED_)
 
     add_log (LOGTYPE_NORMAL, _("\nRerun simulation...\n"));
     gtk_list_store_clear (updater->store);
-    kalu_alpm_has_updates (&packages, &err);
+    kalu_alpm_has_updates (&packages, FALSE, &err);
     updater_get_packages_cb (NULL, (err) ? err->message : NULL, packages, NULL);
     g_clear_error (&err);
     FREE_PACKAGE_LIST (packages);
@@ -3362,7 +3362,7 @@ updater_run (const gchar *conffile, alpm_list_t *cmdline_post)
         gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (updater->pbar_main), 1);
         add_log (LOGTYPE_NORMAL, _("Databases synchronized\n"));
 
-        kalu_alpm_has_updates (&packages, &err);
+        kalu_alpm_has_updates (&packages, FALSE, &err);
         updater_get_packages_cb (NULL, (err) ? err->message : NULL, packages, NULL);
         g_clear_error (&err);
         FREE_PACKAGE_LIST (packages);